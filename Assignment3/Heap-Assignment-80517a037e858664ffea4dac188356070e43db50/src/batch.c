@@ -0,0 +1,47 @@
+#include <stdlib.h>
+
+#include "libmalloc.h"
+
+/*
+ * Generic batch entry points for the builds that have no faster way to do
+ * them.  They are weak, so an allocator that carves runs itself (malloc.c)
+ * overrides them at link time.
+ */
+
+/*
+ * \brief malloc_batch
+ *
+ * Allocates n objects of 'size' bytes one malloc() at a time.
+ *
+ * \return n on success, 0 if any allocation failed (nothing is leaked)
+ */
+__attribute__((weak)) size_t malloc_batch(size_t size, size_t n, void **out)
+{
+    size_t i;
+    for (i = 0; i < n; i++)
+    {
+        out[i] = malloc(size);
+        if (out[i] == NULL)
+        {
+            free_batch(out, i);
+            return 0;
+        }
+    }
+    return n;
+}
+
+/*
+ * \brief free_batch
+ *
+ * Frees n objects one free() at a time.
+ *
+ * \return none
+ */
+__attribute__((weak)) void free_batch(void **ptrs, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++)
+    {
+        free(ptrs[i]);
+    }
+}
@@ -0,0 +1,499 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "large.h"
+#include "libmalloc.h"
+#include "stats.h"
+
+/*
+ * Binary buddy allocator, built with -DBUDDY=0.
+ *
+ * The heap is a set of arenas of 2^ARENA_ORDER bytes, each aligned to its
+ * own size so that the buddy of a block is found by flipping one address
+ * bit.  Free blocks sit on one list per order and a bitmap per arena marks
+ * which block starts are allocated.  malloc splits down from the smallest
+ * non empty order and free merges back up, both O(log arena size).
+ * Requests of LARGE_THRESHOLD bytes and up are mapped on their own through
+ * large_map() rather than rounded up to a power of two.
+ */
+
+#define MIN_ORDER       5                         /* 32 byte smallest block  */
+#define ARENA_ORDER     24                        /* 16 MiB arenas           */
+#define ARENA_SIZE      ((size_t)1 << ARENA_ORDER)
+#define MAX_ARENAS      64
+#define NUM_ORDERS      (ARENA_ORDER + 1)
+#define LARGE_ORDER     0xff                      /* from large_map()        */
+
+#define UNITS           (ARENA_SIZE >> MIN_ORDER)
+#define BITS_PER_WORD   (8 * sizeof(unsigned long))
+
+struct _block
+{
+    size_t  size;         /* Requested bytes, usable bytes if LARGE_ORDER  */
+    size_t  order;        /* _block spans 2^order bytes including header   */
+#if defined HISTOGRAM
+    int     birth;        /* num_mallocs when this _block was handed out   */
+    unsigned long long birth_ticks; /* read_ticks() when it was handed out */
+#endif
+    struct _block *prev;  /* Previous free _block of this order, free only */
+    struct _block *next;  /* Next free _block of this order, free only     */
+};
+
+#define HEADER_SIZE        ((offsetof(struct _block, prev) + 15) & ~(size_t)15)
+#define BLOCK_DATA(b)      ((void *)((char *)(b) + HEADER_SIZE))
+#define BLOCK_HEADER(ptr)  ((struct _block *)((char *)(ptr) - HEADER_SIZE))
+
+struct _arena
+{
+    char          *base;      /* ARENA_SIZE aligned start of the arena     */
+    unsigned long *alloc_map; /* one bit per MIN_ORDER unit, set = in use  */
+};
+
+static struct _arena arenas[MAX_ARENAS];
+static int           num_arenas = 0;
+
+static struct _block *freeLists[NUM_ORDERS];  /* free _blocks of each order  */
+static unsigned long  nonEmpty = 0;           /* bit k set if list k in use  */
+
+/*
+ * \brief orderFor
+ *
+ * \param bytes size of the block including its header
+ *
+ * \return smallest order whose block holds 'bytes'
+ */
+static size_t orderFor(size_t bytes)
+{
+    size_t order = 64 - __builtin_clzll(bytes - 1);
+    return order < MIN_ORDER ? MIN_ORDER : order;
+}
+
+/*
+ * \brief arenaOf
+ *
+ * \param b a _block inside one of our arenas
+ *
+ * \return the arena holding b
+ */
+static struct _arena *arenaOf(struct _block *b)
+{
+    char *base = (char *)((uintptr_t)b & ~(uintptr_t)(ARENA_SIZE - 1));
+    int i;
+    for (i = 0; i < num_arenas; i++)
+    {
+        if (arenas[i].base == base)
+        {
+            return &arenas[i];
+        }
+    }
+    assert(0 && "pointer not allocated by buddy allocator");
+    return NULL;
+}
+
+static void markAllocated(struct _arena *a, struct _block *b, bool used)
+{
+    size_t unit = ((char *)b - a->base) >> MIN_ORDER;
+    if (used)
+    {
+        a->alloc_map[unit / BITS_PER_WORD] |= 1UL << (unit % BITS_PER_WORD);
+    }
+    else
+    {
+        a->alloc_map[unit / BITS_PER_WORD] &= ~(1UL << (unit % BITS_PER_WORD));
+    }
+}
+
+static bool isAllocated(struct _arena *a, struct _block *b)
+{
+    size_t unit = ((char *)b - a->base) >> MIN_ORDER;
+    return (a->alloc_map[unit / BITS_PER_WORD] >> (unit % BITS_PER_WORD)) & 1;
+}
+
+static void pushFree(struct _block *b, size_t order)
+{
+    b->order = order;
+    b->prev = NULL;
+    b->next = freeLists[order];
+    if (b->next)
+    {
+        b->next->prev = b;
+    }
+    freeLists[order] = b;
+    nonEmpty |= 1UL << order;
+}
+
+static void removeFree(struct _block *b)
+{
+    if (b->prev)
+    {
+        b->prev->next = b->next;
+    }
+    else
+    {
+        freeLists[b->order] = b->next;
+        if (b->next == NULL)
+        {
+            nonEmpty &= ~(1UL << b->order);
+        }
+    }
+    if (b->next)
+    {
+        b->next->prev = b->prev;
+    }
+}
+
+/*
+ * \brief growHeap
+ *
+ * Maps a new ARENA_SIZE aligned arena plus its bitmap and puts the whole
+ * arena on the top order free list.
+ *
+ * \return true on success, false if the OS refused
+ */
+static bool growHeap(void)
+{
+    if (num_arenas == MAX_ARENAS)
+    {
+        return false;
+    }
+
+    /* Over map so an aligned arena fits, then trim the slack */
+    char *raw = mmap(NULL, 2 * ARENA_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED)
+    {
+        return false;
+    }
+    char *base = (char *)(((uintptr_t)raw + ARENA_SIZE - 1) & ~(uintptr_t)(ARENA_SIZE - 1));
+    if (base > raw)
+    {
+        munmap(raw, base - raw);
+    }
+    munmap(base + ARENA_SIZE, (raw + 2 * ARENA_SIZE) - (base + ARENA_SIZE));
+
+    unsigned long *map = mmap(NULL, UNITS / 8, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        munmap(base, ARENA_SIZE);
+        return false;
+    }
+
+    arenas[num_arenas].base = base;
+    arenas[num_arenas].alloc_map = map;
+    num_arenas++;
+
+    pushFree((struct _block *)base, ARENA_ORDER);
+
+    num_grows++;
+    num_blocks++;
+    max_heap += ARENA_SIZE;
+    return true;
+}
+
+/*
+ * \brief malloc
+ *
+ * Takes the smallest free _block of at least the needed order and splits
+ * it in halves down to that order.  Grows the heap by one arena if every
+ * list big enough is empty.
+ *
+ * \param size size of the requested memory in bytes
+ *
+ * \return returns the requested memory allocation to the calling process
+ * or NULL if failed
+ */
+void *malloc(size_t size)
+{
+    LATENCY_SCOPE(lat_malloc);
+    num_requested += size;
+    registerStatistics();
+
+#if defined HISTOGRAM
+    size_hist[hist_bucket(size)]++;
+#endif
+
+    /* Handle 0 size */
+    if (size == 0)
+    {
+        return NULL;
+    }
+
+    /* size + HEADER_SIZE must not wrap */
+    if (size > SIZE_MAX - HEADER_SIZE)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    struct _block *b;
+    size_t order = orderFor(size + HEADER_SIZE);
+
+    if (size + HEADER_SIZE >= LARGE_THRESHOLD)
+    {
+        /* Large, give it a mapping of its own instead of a power of two */
+        size_t mapped;
+        b = large_map(size + HEADER_SIZE, &mapped);
+        if (b == NULL)
+        {
+            return NULL;
+        }
+        b->order = LARGE_ORDER;
+        size = mapped - HEADER_SIZE;
+    }
+    else
+    {
+        /* Smallest non empty list at or above the wanted order */
+        unsigned long candidates = nonEmpty & ~((1UL << order) - 1);
+        if (candidates == 0)
+        {
+            if (!growHeap())
+            {
+                return NULL;
+            }
+            candidates = nonEmpty & ~((1UL << order) - 1);
+        }
+        else
+        {
+            num_reuses++;
+        }
+
+        size_t k = __builtin_ctzl(candidates);
+        b = freeLists[k];
+        removeFree(b);
+
+        /* Split off the upper halves until the _block is the right size */
+        while (k > order)
+        {
+            k--;
+            pushFree((struct _block *)((char *)b + ((size_t)1 << k)), k);
+            num_splits++;
+            num_blocks++;
+        }
+        b->order = order;
+        markAllocated(arenaOf(b), b, true);
+    }
+
+    b->size = size;
+    num_mallocs++;
+
+#if defined HISTOGRAM
+    b->birth = num_mallocs;
+    b->birth_ticks = read_ticks();
+#endif
+
+    return BLOCK_DATA(b);
+}
+
+/*
+ * \brief free
+ *
+ * Returns the _block to its free list, first merging it with its buddy
+ * for as long as the buddy is a free _block of the same order.
+ *
+ * \param ptr the heap memory to free
+ *
+ * \return none
+ */
+void free(void *ptr)
+{
+    LATENCY_SCOPE(lat_free);
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    struct _block *b = BLOCK_HEADER(ptr);
+
+#if defined HISTOGRAM
+    life_hist[hist_bucket(num_mallocs - b->birth)]++;
+    tick_hist[hist_bucket(read_ticks() - b->birth_ticks)]++;
+#endif
+
+    num_frees++;
+
+    if (b->order == LARGE_ORDER)
+    {
+        large_unmap(b, b->size + HEADER_SIZE);
+        return;
+    }
+
+    struct _arena *a = arenaOf(b);
+    size_t order = b->order;
+
+    assert(isAllocated(a, b));
+    markAllocated(a, b, false);
+
+    while (order < ARENA_ORDER)
+    {
+        uintptr_t offset = (char *)b - a->base;
+        struct _block *buddy = (struct _block *)(a->base + (offset ^ ((uintptr_t)1 << order)));
+
+        /* buddy start is always a _block start, free and whole if clear and same order */
+        if (isAllocated(a, buddy) || buddy->order != order)
+        {
+            break;
+        }
+        removeFree(buddy);
+        if (buddy < b)
+        {
+            b = buddy;
+        }
+        order++;
+
+        num_coalesces++;
+        num_blocks--;
+    }
+    pushFree(b, order);
+}
+
+/*
+ * \brief calloc
+ *
+ * Allocates zeroed memory for an array of nmemb elements of size bytes each.
+ *
+ * \return returns a pointer to the allocated memory, NULL if failed
+ */
+void *calloc(size_t nmemb, size_t size)
+{
+    if (size && nmemb > (size_t)-1 / size)
+    {
+        return NULL;
+    }
+    void *ptr = malloc(nmemb*size);
+    if (ptr)
+    {
+        memset(ptr, 0, nmemb*size);
+    }
+    return (ptr);
+}
+
+/*
+ * \brief realloc
+ *
+ * Keeps the _block when the new size still fits its order and is more
+ * than half of it, otherwise moves the data to a _block of the right order.
+ *
+ * \return the resized memory, NULL if failed
+ */
+void *realloc(void *ptr, size_t size)
+{
+    LATENCY_SCOPE(lat_realloc);
+    if (ptr == NULL)
+    {
+        return malloc(size);
+    }
+    if (size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+    if (size > SIZE_MAX - HEADER_SIZE)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    struct _block *b = BLOCK_HEADER(ptr);
+    if (b->order == LARGE_ORDER)
+    {
+        if (size <= b->size)
+        {
+            return ptr;
+        }
+    }
+    else if (orderFor(size + HEADER_SIZE) == b->order &&
+             size + HEADER_SIZE < LARGE_THRESHOLD)
+    {
+        b->size = size;
+        return ptr;
+    }
+
+    void *newptr = malloc(size);
+    if (newptr == NULL)
+    {
+        return NULL;
+    }
+    size_t usable = malloc_usable_size(ptr);
+    memcpy(newptr, ptr, usable < size ? usable : size);
+    free(ptr);
+    num_realloc_moves++;
+    return newptr;
+}
+
+/*
+ * \brief malloc_usable_size
+ *
+ * Orders are powers of two, so the whole _block past the header is usable
+ * and growth within an order never copies.
+ *
+ * \return the bytes that can be used at ptr
+ */
+size_t malloc_usable_size(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return 0;
+    }
+    struct _block *b = BLOCK_HEADER(ptr);
+    if (b->order == LARGE_ORDER)
+    {
+        return b->size;
+    }
+    return ((size_t)1 << b->order) - HEADER_SIZE;
+}
+
+/*
+ * \brief heap_walk
+ *
+ * Walks each arena block by block; free and allocated _blocks both carry
+ * their order, so the next one starts 2^order bytes further on.
+ *
+ * \return none
+ */
+void heap_walk(heap_walker fn, void *arg)
+{
+    int i;
+    for (i = 0; i < num_arenas; i++)
+    {
+        char *p = arenas[i].base;
+        while (p < arenas[i].base + ARENA_SIZE)
+        {
+            struct _block *b = (struct _block *)p;
+            size_t bytes = (size_t)1 << b->order;
+            fn(b, HEADER_SIZE, bytes - HEADER_SIZE, isAllocated(&arenas[i], b), arg);
+            p += bytes;
+        }
+    }
+}
+
+/*
+ * \brief heapFreeSpace
+ *
+ * Sums up the free _blocks for the fragmentation statistics.
+ *
+ * \return none
+ */
+void heapFreeSpace(size_t *free_bytes, size_t *largest_free)
+{
+    size_t order;
+    struct _block *b;
+
+    *free_bytes = 0;
+    *largest_free = 0;
+    for (order = MIN_ORDER; order < NUM_ORDERS; order++)
+    {
+        for (b = freeLists[order]; b; b = b->next)
+        {
+            *free_bytes += ((size_t)1 << order) - HEADER_SIZE;
+            *largest_free = ((size_t)1 << order) - HEADER_SIZE;
+        }
+    }
+}
@@ -0,0 +1,374 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "libmalloc.h"
+#include "stats.h"
+
+/*
+ * Object caches in the style of the SunOS/Linux slab allocator.  Each cache
+ * hands out objects of one size from slabs, mappings aligned to their own
+ * size so the slab of an object is found by masking its address.  Objects
+ * are constructed once when their slab is created and destructed only when
+ * the slab goes away; in between, cache_free() and cache_alloc() pass them
+ * around in constructed state.  The free objects of a slab are a stack of
+ * indexes kept in the slab header, so no link ever overwrites an object.
+ * Successive slabs start their objects at different offsets (colours) so
+ * the same object of every slab does not land on the same cache lines.
+ */
+
+#define SLAB_MIN_SIZE       (64 * 1024)
+#define SLAB_MAX_SIZE       ((SIZE_MAX >> 2) + 1)  /* newSlab() maps twice this */
+#define SLAB_MIN_OBJECTS    8
+#define COLOUR_STEP         64                  /* one cache line            */
+#define NAME_LEN            32
+
+struct _slab
+{
+    struct cache *cache;    /* Cache the slab belongs to                    */
+    struct _slab *prev;     /* Previous slab on the same list               */
+    struct _slab *next;     /* Next slab on the same list                   */
+    char     *objects;      /* First object, after the colour               */
+    unsigned  inuse;        /* Objects handed out                           */
+    unsigned  nfree;        /* Entries on the free stack                    */
+    uint16_t  free[];       /* Indexes of the free objects                  */
+};
+
+struct cache
+{
+    char      name[NAME_LEN];
+    size_t    size;         /* Object size as asked for                     */
+    size_t    align;        /* Object alignment                             */
+    size_t    stride;       /* Distance between objects                     */
+    size_t    slab_size;    /* Bytes per slab, a power of two               */
+    unsigned  per_slab;     /* Objects per slab                             */
+    size_t    max_colour;   /* Largest colour offset that fits              */
+    size_t    next_colour;  /* Colour of the next slab                      */
+    void    (*ctor)(void *);
+    void    (*dtor)(void *);
+
+    struct _slab *partial;  /* Slabs with free and used objects             */
+    struct _slab *full;     /* Slabs with no free object                    */
+    struct _slab *empty;    /* Slabs with no used object, until reaped      */
+
+    unsigned long allocs, frees, slabs, reaped, ctors;
+    struct cache *next;     /* Next cache on the global list                */
+};
+
+static struct cache *caches = NULL;
+
+static void unlinkSlab(struct _slab **list, struct _slab *s)
+{
+    if (s->prev)
+    {
+        s->prev->next = s->next;
+    }
+    else
+    {
+        *list = s->next;
+    }
+    if (s->next)
+    {
+        s->next->prev = s->prev;
+    }
+}
+
+static void pushSlab(struct _slab **list, struct _slab *s)
+{
+    s->prev = NULL;
+    s->next = *list;
+    if (s->next)
+    {
+        s->next->prev = s;
+    }
+    *list = s;
+}
+
+static size_t headerSize(unsigned per_slab, size_t align)
+{
+    size_t bytes = sizeof(struct _slab) + per_slab * sizeof(uint16_t);
+    return (bytes + align - 1) & ~(align - 1);
+}
+
+/*
+ * \brief newSlab
+ *
+ * Maps a slab aligned to its size, picks its colour and constructs every
+ * object in it.
+ *
+ * \return the slab or NULL if the OS refused
+ */
+static struct _slab *newSlab(struct cache *c)
+{
+    char *raw = mmap(NULL, 2 * c->slab_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+    {
+        return NULL;
+    }
+    char *base = (char *)(((uintptr_t)raw + c->slab_size - 1) & ~(uintptr_t)(c->slab_size - 1));
+    if (base > raw)
+    {
+        munmap(raw, base - raw);
+    }
+    munmap(base + c->slab_size, (raw + 2 * c->slab_size) - (base + c->slab_size));
+
+    struct _slab *s = (struct _slab *)base;
+    s->cache = c;
+    s->inuse = 0;
+    s->nfree = c->per_slab;
+    s->objects = base + headerSize(c->per_slab, c->align) + c->next_colour;
+
+    c->next_colour += COLOUR_STEP > c->align ? COLOUR_STEP : c->align;
+    if (c->next_colour > c->max_colour)
+    {
+        c->next_colour = 0;
+    }
+
+    /* hand out low addresses first */
+    unsigned i;
+    for (i = 0; i < c->per_slab; i++)
+    {
+        s->free[i] = c->per_slab - 1 - i;
+        if (c->ctor)
+        {
+            c->ctor(s->objects + i * c->stride);
+            c->ctors++;
+        }
+    }
+
+    c->slabs++;
+    return s;
+}
+
+static void destroySlab(struct cache *c, struct _slab *s)
+{
+    unsigned i;
+    if (c->dtor)
+    {
+        for (i = 0; i < c->per_slab; i++)
+        {
+            c->dtor(s->objects + i * c->stride);
+        }
+    }
+    munmap(s, c->slab_size);
+    c->reaped++;
+}
+
+/*
+ * \brief cache_create
+ *
+ * \param name shown in the statistics
+ * \param size size of each object in bytes
+ * \param align alignment of each object, a power of two up to 4096, 0 for
+ *        pointer alignment
+ * \param ctor called once on every object when its slab is created, or NULL
+ * \param dtor called once on every object when its slab is released, or NULL
+ *
+ * \return the cache or NULL if the arguments are unusable
+ */
+struct cache *cache_create(const char *name, size_t size, size_t align,
+                           void (*ctor)(void *), void (*dtor)(void *))
+{
+    if (align == 0)
+    {
+        align = sizeof(void *);
+    }
+    if (size == 0 || (align & (align - 1)) || align > 4096)
+    {
+        return NULL;
+    }
+    /* the stride and the slab doubling below must not overflow */
+    if (size > (SLAB_MAX_SIZE - headerSize(SLAB_MIN_OBJECTS, align)) / SLAB_MIN_OBJECTS - align)
+    {
+        return NULL;
+    }
+
+    struct cache *c = calloc(1, sizeof(struct cache));
+    if (c == NULL)
+    {
+        return NULL;
+    }
+
+    strncpy(c->name, name ? name : "", NAME_LEN - 1);
+    c->size = size;
+    c->align = align;
+    c->stride = (size + align - 1) & ~(align - 1);
+    c->ctor = ctor;
+    c->dtor = dtor;
+
+    c->slab_size = SLAB_MIN_SIZE;
+    while (c->slab_size < SLAB_MIN_OBJECTS * c->stride + headerSize(SLAB_MIN_OBJECTS, align))
+    {
+        c->slab_size <<= 1;
+    }
+
+    /* as many objects as fit with their free stack entries, at most 64K */
+    unsigned n = c->slab_size / c->stride;
+    while (n > 0 && headerSize(n, align) + n * c->stride > c->slab_size)
+    {
+        n--;
+    }
+    if (n > UINT16_MAX + 1)
+    {
+        n = UINT16_MAX + 1;
+    }
+    c->per_slab = n;
+    c->max_colour = c->slab_size - headerSize(n, align) - n * c->stride;
+
+    c->next = caches;
+    caches = c;
+    registerStatistics();
+    return c;
+}
+
+/*
+ * \brief cache_alloc
+ *
+ * \return a constructed object or NULL if out of memory
+ */
+void *cache_alloc(struct cache *c)
+{
+    struct _slab *s = c->partial;
+    if (s == NULL)
+    {
+        s = c->empty;
+        if (s)
+        {
+            unlinkSlab(&c->empty, s);
+        }
+        else
+        {
+            s = newSlab(c);
+            if (s == NULL)
+            {
+                return NULL;
+            }
+        }
+        pushSlab(&c->partial, s);
+    }
+
+    unsigned i = s->free[--s->nfree];
+    s->inuse++;
+    if (s->nfree == 0)
+    {
+        unlinkSlab(&c->partial, s);
+        pushSlab(&c->full, s);
+    }
+
+    c->allocs++;
+    return s->objects + i * c->stride;
+}
+
+/*
+ * \brief cache_free
+ *
+ * Returns an object, still constructed, to its slab.  The caller must put
+ * it back in the state the constructor left it in.  Slabs that empty out
+ * are kept, constructed, until cache_reap().
+ *
+ * \return none
+ */
+void cache_free(struct cache *c, void *obj)
+{
+    if (obj == NULL)
+    {
+        return;
+    }
+
+    struct _slab *s = (struct _slab *)((uintptr_t)obj & ~(uintptr_t)(c->slab_size - 1));
+    unsigned i = ((char *)obj - s->objects) / c->stride;
+
+    if (s->nfree == 0)
+    {
+        unlinkSlab(&c->full, s);
+        pushSlab(&c->partial, s);
+    }
+    s->free[s->nfree++] = i;
+    s->inuse--;
+    c->frees++;
+
+    if (s->inuse == 0)
+    {
+        unlinkSlab(&c->partial, s);
+        pushSlab(&c->empty, s);
+    }
+}
+
+/*
+ * \brief cache_reap
+ *
+ * Destructs and unmaps the slabs with no object in use.
+ *
+ * \return the bytes given back to the OS
+ */
+size_t cache_reap(struct cache *c)
+{
+    size_t bytes = 0;
+    while (c->empty)
+    {
+        struct _slab *s = c->empty;
+        unlinkSlab(&c->empty, s);
+        destroySlab(c, s);
+        bytes += c->slab_size;
+    }
+    return bytes;
+}
+
+/*
+ * \brief cache_destroy
+ *
+ * Destructs and unmaps every slab.  Objects still in use are lost.
+ *
+ * \return none
+ */
+void cache_destroy(struct cache *c)
+{
+    struct _slab **lists[] = { &c->partial, &c->full, &c->empty };
+    unsigned l;
+    for (l = 0; l < 3; l++)
+    {
+        while (*lists[l])
+        {
+            struct _slab *s = *lists[l];
+            unlinkSlab(lists[l], s);
+            destroySlab(c, s);
+        }
+    }
+
+    struct cache **p;
+    for (p = &caches; *p; p = &(*p)->next)
+    {
+        if (*p == c)
+        {
+            *p = c->next;
+            break;
+        }
+    }
+    free(c);
+}
+
+/*
+ * \brief printCaches
+ *
+ * Prints one line of statistics per live cache.
+ *
+ * \return none
+ */
+void printCaches(void)
+{
+    struct cache *c;
+    if (caches == NULL)
+    {
+        return;
+    }
+
+    printf("\ncache\t\tsize\tper slab\tallocs\tfrees\tslabs\treaped\tctors\n");
+    for (c = caches; c; c = c->next)
+    {
+        printf("%-15s\t%zu\t%u\t\t%lu\t%lu\t%lu\t%lu\t%lu\n", c->name, c->size,
+               c->per_slab, c->allocs, c->frees, c->slabs, c->reaped, c->ctors);
+    }
+}
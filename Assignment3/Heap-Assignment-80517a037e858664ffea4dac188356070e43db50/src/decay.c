@@ -0,0 +1,278 @@
+#define _GNU_SOURCE         /* PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#if defined DECAY_THREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "decay.h"
+#include "stats.h"
+
+#define PAGE_SIZE           4096
+#define PAGE_UP(a)          (((a) + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1))
+#define PAGE_DOWN(a)        ((a) & ~(uintptr_t)(PAGE_SIZE - 1))
+
+#if defined DECAY_MADV_FREE
+#define DECAY_ADVICE        MADV_FREE
+#else
+#define DECAY_ADVICE        MADV_DONTNEED
+#endif
+
+long long decay_purged = 0;
+
+static long window_ms = -1;         /* decay window, read on first use      */
+
+/* one tick's view of the dirty bytes, filled by the first pass */
+struct _tick
+{
+    unsigned int now;
+    long long    by_age[DECAY_EPOCHS + 1];   /* last one: fully decayed    */
+    int          full_age;                   /* purge everything this old  */
+    long long    quota;                      /* and this much one younger  */
+};
+
+#if defined DECAY_THREAD
+static pthread_mutex_t decay_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static bool thread_started = false;
+#endif
+
+/* whole pages inside [start, start + bytes) */
+static void interior(void *start, size_t bytes, uintptr_t *lo, uintptr_t *hi)
+{
+    *lo = PAGE_UP((uintptr_t)start);
+    *hi = PAGE_DOWN((uintptr_t)start + bytes);
+    if (*hi < *lo)
+    {
+        *hi = *lo;
+    }
+}
+
+static int ageOf(unsigned int dirty, unsigned int now)
+{
+    unsigned int age = now - dirty;
+    return age < DECAY_EPOCHS ? (int)age : DECAY_EPOCHS;
+}
+
+/*
+ * \brief epochMs
+ *
+ * \return the length of an epoch in ms, 0 if decay is off.  The window is
+ * DECAY_MS unless the LIBMALLOC_DECAY_MS environment variable overrides it.
+ */
+static long epochMs(void)
+{
+    if (window_ms < 0)
+    {
+        const char *env = getenv("LIBMALLOC_DECAY_MS");
+        window_ms = env ? atol(env) : DECAY_MS;
+        if (window_ms < 0)
+        {
+            window_ms = 0;
+        }
+    }
+    if (window_ms == 0)
+    {
+        return 0;
+    }
+    return window_ms >= DECAY_EPOCHS ? window_ms / DECAY_EPOCHS : 1;
+}
+
+/*
+ * \brief decay_epoch
+ *
+ * \return the current epoch.  Never 0, which marks a purged _block.
+ */
+unsigned int decay_epoch(void)
+{
+    long epoch = epochMs();
+    if (epoch == 0)
+    {
+        return 1;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    unsigned long long ms = ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+    return (unsigned int)(ms / epoch) + 1;
+}
+
+static void countDirty(unsigned int *dirty, void *start, size_t bytes, void *arg)
+{
+    struct _tick *t = arg;
+    uintptr_t lo, hi;
+
+    if (*dirty == 0)
+    {
+        return;
+    }
+    interior(start, bytes, &lo, &hi);
+    t->by_age[ageOf(*dirty, t->now)] += hi - lo;
+}
+
+static void purgeOld(unsigned int *dirty, void *start, size_t bytes, void *arg)
+{
+    struct _tick *t = arg;
+    uintptr_t lo, hi;
+
+    if (*dirty == 0)
+    {
+        return;
+    }
+    int age = ageOf(*dirty, t->now);
+    if (age < t->full_age - 1 || (age == t->full_age - 1 && t->quota <= 0))
+    {
+        return;
+    }
+
+    interior(start, bytes, &lo, &hi);
+    if (hi > lo)
+    {
+        madvise((void *)lo, hi - lo, DECAY_ADVICE);
+        decay_purged += hi - lo;
+        if (age < t->full_age)
+        {
+            t->quota -= hi - lo;
+        }
+    }
+    *dirty = 0;
+}
+
+/*
+ * \brief decayTick
+ *
+ * One purge step.  The first pass sums the dirty bytes by age, the
+ * second purges the oldest _blocks until what is left is within the
+ * decay curve.
+ *
+ * \return none
+ */
+static void decayTick(unsigned int now)
+{
+    struct _tick t = { .now = now };
+    int age;
+
+    decayForEach(countDirty, &t);
+
+    long long dirty = 0, allowed = 0;
+    for (age = 0; age <= DECAY_EPOCHS; age++)
+    {
+        dirty += t.by_age[age];
+        allowed += t.by_age[age] * (DECAY_EPOCHS - age) / DECAY_EPOCHS;
+    }
+
+    long long excess = dirty - allowed;
+    if (excess <= 0)
+    {
+        return;
+    }
+
+    /* oldest first: whole ages while they fit, then part of the next */
+    for (age = DECAY_EPOCHS; age > 0 && t.by_age[age] <= excess; age--)
+    {
+        excess -= t.by_age[age];
+    }
+    t.full_age = age + 1;
+    t.quota = excess;
+
+    decayForEach(purgeOld, &t);
+}
+
+#if defined DECAY_THREAD
+static void *decayThread(void *arg)
+{
+    for (;;)
+    {
+        usleep(epochMs() * 1000);
+        pthread_mutex_lock(&decay_mutex);
+        decayTick(decay_epoch());
+        pthread_mutex_unlock(&decay_mutex);
+    }
+    return NULL;
+}
+
+int decay_lock(void)
+{
+    pthread_mutex_lock(&decay_mutex);
+    return 1;
+}
+
+void decay_unlock(int *held)
+{
+    pthread_mutex_unlock(&decay_mutex);
+}
+#endif
+
+/*
+ * \brief decay_maybe
+ *
+ * Called at the end of free().  Runs a purge step if an epoch has passed
+ * since the last one, or starts the background thread that does so.
+ *
+ * \return none
+ */
+void decay_maybe(void)
+{
+    if (epochMs() == 0)
+    {
+        return;
+    }
+#if defined DECAY_THREAD
+    if (!thread_started)
+    {
+        pthread_t tid;
+        thread_started = true;
+        if (pthread_create(&tid, NULL, decayThread, NULL) == 0)
+        {
+            pthread_detach(tid);
+        }
+    }
+#else
+    static unsigned int last_tick = 0;
+    unsigned int now = decay_epoch();
+    if (now != last_tick)
+    {
+        last_tick = now;
+        decayTick(now);
+    }
+#endif
+}
+
+static void sumDirty(unsigned int *dirty, void *start, size_t bytes, void *arg)
+{
+    uintptr_t lo, hi;
+    if (*dirty)
+    {
+        interior(start, bytes, &lo, &hi);
+        *(long long *)arg += hi - lo;
+    }
+}
+
+/*
+ * \brief decay_dirty_bytes
+ *
+ * \return the whole free pages not purged yet
+ */
+long long decay_dirty_bytes(void)
+{
+    long long dirty = 0;
+    decayForEach(sumDirty, &dirty);
+    return dirty;
+}
+
+/*
+ * \brief decayForEach
+ *
+ * Fallback for builds that do not track dirty _blocks, visits nothing.
+ * malloc.c overrides it.
+ *
+ * \return none
+ */
+__attribute__((weak)) void decayForEach(decay_visit fn, void *arg)
+{
+}
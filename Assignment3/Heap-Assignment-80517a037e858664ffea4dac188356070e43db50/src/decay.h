@@ -0,0 +1,48 @@
+#ifndef DECAY_H
+#define DECAY_H
+
+#include <stddef.h>
+
+/*
+ * Decay based purging of dirty free pages.  A free _block remembers the
+ * epoch it was freed in, and the whole pages inside it are handed back
+ * with madvise() gradually: of the bytes freed at epoch e, at most a
+ * (DECAY_EPOCHS - age) / DECAY_EPOCHS share is still dirty 'age' epochs
+ * later, oldest first.  A burst of frees followed by a burst of mallocs
+ * reuses the pages untouched, while memory idle for a whole DECAY_MS
+ * window goes back to the OS.
+ *
+ * Purging runs from free() whenever an epoch has passed, or with
+ * -DDECAY_THREAD from a background thread, in which case the entry points
+ * serialize with it through DECAY_GUARD().  The window is DECAY_MS or
+ * the LIBMALLOC_DECAY_MS environment variable, 0 turns purging off.
+ * -DDECAY_MADV_FREE purges with MADV_FREE instead of MADV_DONTNEED.
+ */
+
+#pragma GCC visibility push(hidden)
+
+#ifndef DECAY_MS
+#define DECAY_MS            10000               /* default window, ms    */
+#endif
+#define DECAY_EPOCHS        10                  /* steps per window      */
+
+/* called for every free _block, 'dirty' is its epoch, 0 once purged */
+typedef void (*decay_visit)( unsigned int *dirty, void *start, size_t bytes, void *arg );
+
+unsigned int decay_epoch( void );
+void         decay_maybe( void );
+long long    decay_dirty_bytes( void );
+void         decayForEach( decay_visit fn, void *arg );
+
+#if defined DECAY_THREAD
+int  decay_lock( void );
+void decay_unlock( int *held );
+
+#define DECAY_GUARD()      int decay_held __attribute__((cleanup(decay_unlock))) = decay_lock()
+#else
+#define DECAY_GUARD()
+#endif
+
+#pragma GCC visibility pop
+
+#endif
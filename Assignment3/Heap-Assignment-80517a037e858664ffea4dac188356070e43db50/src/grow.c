@@ -0,0 +1,36 @@
+#include <stdlib.h>
+
+#include "libmalloc.h"
+
+/*
+ * \brief realloc_grow
+ *
+ * Grows an append buffer to hold at least 'min' bytes.  Nothing happens
+ * while the current capacity suffices; otherwise the buffer at least
+ * doubles, so n single byte appends cost O(n) bytes copied in total.
+ *
+ * \param ptr the buffer, NULL to allocate one
+ * \param min bytes the buffer must hold
+ * \param hint expected final size, 0 if unknown
+ *
+ * \return the buffer, possibly moved, or NULL if failed (ptr is untouched)
+ */
+void *realloc_grow(void *ptr, size_t min, size_t hint)
+{
+    size_t usable = malloc_usable_size(ptr);
+    if (ptr && usable >= min)
+    {
+        return ptr;
+    }
+
+    size_t want = 2 * usable;
+    if (want < min)
+    {
+        want = min;
+    }
+    if (want < hint)
+    {
+        want = hint;
+    }
+    return realloc(ptr, want);
+}
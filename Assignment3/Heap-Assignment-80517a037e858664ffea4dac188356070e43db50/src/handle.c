@@ -0,0 +1,280 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "libmalloc.h"
+#include "stats.h"
+
+/*
+ * Relocatable allocation through handles.
+ *
+ * Objects live in their own heap, a large reserved mapping filled from the
+ * bottom by bumping 'top'.  Callers only hold handles; the address behind a
+ * handle is pinned between hlock() and hunlock() and may change otherwise.
+ * That lets an incremental compactor slide unlocked objects down over the
+ * holes left by hfree(), a bounded number of bytes per halloc() whenever
+ * the holes are worth it.  When a pass reaches the top, the top drops to
+ * the end of the compacted objects and the pages above it are released.
+ *
+ * During a pass the heap looks like
+ *
+ *    base .. dest      compacted _hblocks
+ *    dest .. scan      gap left by the objects already moved down
+ *    scan .. top       _hblocks not visited yet
+ */
+
+#define ALIGN16(s)          (((s) + 15) & ~(size_t)15)
+#define PAGE_UP(s)          (((s) + 4095) & ~(uintptr_t)4095)
+
+#define HEAP_RESERVE        ((size_t)1 << 30)     /* address space for objects */
+#define MAX_HANDLES         ((size_t)1 << 20)
+#define COMPACT_STEP        (64 * 1024)           /* bytes moved per step      */
+
+struct handle
+{
+    void    *ptr;         /* Object data, or next free handle          */
+    unsigned locks;       /* hlock() nesting count, pinned while > 0   */
+};
+
+struct _hblock
+{
+    size_t  size;         /* Total size of the _hblock in bytes        */
+    struct handle *owner; /* Handle pointing here, NULL if free        */
+};
+
+#define HBLOCK_DATA(b)      ((void *)((b) + 1))
+
+static char *base = NULL;          /* start of the object heap               */
+static char *top;                  /* first byte never handed out            */
+static char *dest;                 /* compaction: end of the compacted part  */
+static char *scan;                 /* compaction: next _hblock to visit      */
+static char *committed;            /* highest page ever touched              */
+static size_t live_bytes = 0;      /* bytes in allocated _hblocks            */
+
+static struct handle *handles;     /* handle table                           */
+static size_t num_handles = 0;     /* handles ever used from the table       */
+static struct handle *freeHandles = NULL;
+
+int num_handle_moves = 0;
+long long handle_trimmed = 0;
+
+static bool init(void)
+{
+    base = mmap(NULL, HEAP_RESERVE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        base = NULL;
+        return false;
+    }
+    handles = mmap(NULL, MAX_HANDLES * sizeof(struct handle), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (handles == MAP_FAILED)
+    {
+        munmap(base, HEAP_RESERVE);
+        base = NULL;
+        return false;
+    }
+    top = dest = scan = committed = base;
+    return true;
+}
+
+/*
+ * \brief compactStep
+ *
+ * Advances the current compaction pass by up to 'budget' moved bytes.
+ * Unlocked objects slide down to 'dest'; a locked one cannot move, so the
+ * gap in front of it becomes a free _hblock and compaction resumes after
+ * it.  Finishing the pass lowers the top and trims the pages above it.
+ *
+ * \param budget bytes that may be moved in this step
+ *
+ * \return true if the pass finished
+ */
+static bool compactStep(size_t budget)
+{
+    size_t moved = 0;
+
+    while (scan < top && moved < budget)
+    {
+        struct _hblock *b = (struct _hblock *)scan;
+        size_t size = b->size;
+
+        if (b->owner == NULL)
+        {
+            /* hole, becomes part of the gap */
+        }
+        else if (b->owner->locks == 0)
+        {
+            if (dest != scan)
+            {
+                memmove(dest, scan, size);
+                b = (struct _hblock *)dest;
+                b->owner->ptr = HBLOCK_DATA(b);
+                num_handle_moves++;
+                moved += size;
+            }
+            dest += size;
+        }
+        else
+        {
+            /* pinned, close the gap in front of it with a free _hblock */
+            if (dest != scan)
+            {
+                struct _hblock *gap = (struct _hblock *)dest;
+                gap->size = scan - dest;
+                gap->owner = NULL;
+            }
+            dest = scan + size;
+        }
+        scan += size;
+    }
+
+    if (scan < top)
+    {
+        return false;
+    }
+
+    /* pass done, everything above dest is garbage */
+    top = dest;
+    char *keep = (char *)PAGE_UP((uintptr_t)top);
+    if (committed > keep)
+    {
+        madvise(keep, committed - keep, MADV_DONTNEED);
+        handle_trimmed += committed - keep;
+        committed = keep;
+    }
+    dest = scan = base;
+    return true;
+}
+
+/*
+ * \brief halloc
+ *
+ * Allocates a relocatable object at the top of the handle heap.  When the
+ * holes in the heap exceed a quarter of the live bytes, a bounded
+ * compaction step runs first; a full pass only runs if the reserve is
+ * exhausted.
+ *
+ * \param size size of the requested memory in bytes
+ *
+ * \return a handle to the object or NULL if failed
+ */
+struct handle *halloc(size_t size)
+{
+    if (base == NULL && !init())
+    {
+        return NULL;
+    }
+    if (size == 0)
+    {
+        return NULL;
+    }
+
+    size_t need = sizeof(struct _hblock) + ALIGN16(size);
+
+    /* slow path: reclaim holes a step at a time */
+    size_t holes = (top - base) - live_bytes;
+    if (holes > live_bytes / 4 && holes > COMPACT_STEP)
+    {
+        compactStep(COMPACT_STEP);
+    }
+
+    if (top + need > base + HEAP_RESERVE)
+    {
+        while (!compactStep((size_t)-1))
+        {
+        }
+        if (top + need > base + HEAP_RESERVE)
+        {
+            return NULL;
+        }
+    }
+
+    struct handle *h = freeHandles;
+    if (h)
+    {
+        freeHandles = h->ptr;
+    }
+    else
+    {
+        if (num_handles == MAX_HANDLES)
+        {
+            return NULL;
+        }
+        h = &handles[num_handles++];
+    }
+
+    struct _hblock *b = (struct _hblock *)top;
+    b->size = need;
+    b->owner = h;
+    top += need;
+    if (top > committed)
+    {
+        committed = (char *)PAGE_UP((uintptr_t)top);
+    }
+
+    h->ptr = HBLOCK_DATA(b);
+    h->locks = 0;
+    live_bytes += need;
+    return h;
+}
+
+/*
+ * \brief hlock
+ *
+ * Pins the object so the compactor leaves it where it is.  Calls nest.
+ *
+ * \return the object's current address, valid until the matching hunlock()
+ */
+void *hlock(struct handle *h)
+{
+    h->locks++;
+    return h->ptr;
+}
+
+/*
+ * \brief hunlock
+ *
+ * Undoes one hlock(); the object may move again once the count is zero.
+ *
+ * \return none
+ */
+void hunlock(struct handle *h)
+{
+    h->locks--;
+}
+
+/*
+ * \brief hsize
+ *
+ * \return the usable size of the object behind the handle
+ */
+size_t hsize(struct handle *h)
+{
+    return ((struct _hblock *)h->ptr - 1)->size - sizeof(struct _hblock);
+}
+
+/*
+ * \brief hfree
+ *
+ * Frees the object and its handle.  The space turns into a hole that a
+ * later compaction pass reclaims.
+ *
+ * \return none
+ */
+void hfree(struct handle *h)
+{
+    if (h == NULL)
+    {
+        return;
+    }
+
+    struct _hblock *b = (struct _hblock *)h->ptr - 1;
+    b->owner = NULL;
+    live_bytes -= b->size;
+
+    h->ptr = freeHandles;
+    freeHandles = h;
+}
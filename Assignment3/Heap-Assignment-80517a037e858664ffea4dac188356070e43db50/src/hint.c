@@ -0,0 +1,157 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "hint.h"
+#include "libmalloc.h"
+#include "stats.h"
+
+#define ARENA_ALIGN(s)      (((s) + 15) & ~(size_t)15)
+
+struct _arena
+{
+    size_t  used;         /* Offset of the first unused byte           */
+    int     live;         /* Objects handed out and not yet freed      */
+};
+
+#define ARENA_START         ARENA_ALIGN(sizeof(struct _arena))
+#define ARENA_OF(ptr)       ((struct _arena *)((uintptr_t)(ptr) & ~(uintptr_t)(SHORT_ARENA_SIZE - 1)))
+
+static struct _arena *current = NULL;   /* arena we bump allocate in         */
+static struct _arena *spare   = NULL;   /* one empty, trimmed arena kept back */
+
+int num_short_arenas = 0;
+int num_short_trims  = 0;
+
+/*
+ * \brief newArena
+ *
+ * Maps a SHORT_ARENA_SIZE aligned arena.
+ *
+ * \return the arena or NULL if mmap failed
+ */
+static struct _arena *newArena(void)
+{
+    char *raw = mmap(NULL, 2 * SHORT_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+    {
+        return NULL;
+    }
+    char *base = (char *)(((uintptr_t)raw + SHORT_ARENA_SIZE - 1) & ~(uintptr_t)(SHORT_ARENA_SIZE - 1));
+    if (base > raw)
+    {
+        munmap(raw, base - raw);
+    }
+    munmap(base + SHORT_ARENA_SIZE, (raw + 2 * SHORT_ARENA_SIZE) - (base + SHORT_ARENA_SIZE));
+
+    num_short_arenas++;
+    num_grows++;
+    max_heap += SHORT_ARENA_SIZE;
+    return (struct _arena *)base;
+}
+
+/*
+ * \brief short_alloc
+ *
+ * Bump allocates 'bytes' bytes from the current short lived arena.  A full
+ * arena is left to drain and a fresh one (the spare if there is one) takes
+ * its place.
+ *
+ * \param bytes bytes needed, at most SHORT_MAX
+ *
+ * \return 16 byte aligned memory or NULL if failed
+ */
+void *short_alloc(size_t bytes)
+{
+    bytes = ARENA_ALIGN(bytes);
+
+    if (current && current->used + bytes > SHORT_ARENA_SIZE)
+    {
+        if (current->live == 0)
+        {
+            current->used = ARENA_START;
+        }
+        else
+        {
+            current = NULL;   // the last short_free() in it will trim it
+        }
+    }
+
+    if (current == NULL)
+    {
+        if (spare)
+        {
+            current = spare;
+            spare = NULL;
+        }
+        else
+        {
+            current = newArena();
+            if (current == NULL)
+            {
+                return NULL;
+            }
+        }
+        current->used = ARENA_START;
+        current->live = 0;
+    }
+
+    void *ptr = (char *)current + current->used;
+    current->used += bytes;
+    current->live++;
+    return ptr;
+}
+
+/*
+ * \brief short_free
+ *
+ * Drops one object from its arena.  Once an arena has no live objects the
+ * current one is simply rewound; a retired one is trimmed, kept as the
+ * spare with its pages released, or unmapped if there already is a spare.
+ *
+ * \param ptr memory from short_alloc()
+ *
+ * \return none
+ */
+void short_free(void *ptr)
+{
+    struct _arena *a = ARENA_OF(ptr);
+
+    if (--a->live > 0)
+    {
+        return;
+    }
+
+    if (a == current)
+    {
+        a->used = ARENA_START;
+        return;
+    }
+
+    num_short_trims++;
+    if (spare == NULL)
+    {
+        madvise((char *)a + 4096, SHORT_ARENA_SIZE - 4096, MADV_DONTNEED);
+        spare = a;
+    }
+    else
+    {
+        munmap(a, SHORT_ARENA_SIZE);
+        num_short_arenas--;
+    }
+}
+
+/*
+ * \brief malloc_hint
+ *
+ * Generic version for builds without a short lived sub-heap, the hint is
+ * ignored.  Weak, malloc.c overrides it.
+ *
+ * \return the allocation or NULL if failed
+ */
+__attribute__((weak)) void *malloc_hint(size_t size, int hint)
+{
+    (void)hint;
+    return malloc(size);
+}
@@ -0,0 +1,23 @@
+#ifndef HINT_H
+#define HINT_H
+
+#include <stddef.h>
+
+/*
+ * Short lived sub-heap used by malloc_hint(HINT_SHORT).  Objects are bump
+ * allocated out of aligned arenas that only count their live objects, so
+ * an arena whose objects have all died is empty as a whole and can be
+ * rewound or trimmed, and long lived objects never end up pinning it.
+ */
+
+#pragma GCC visibility push(hidden)
+
+#define SHORT_ARENA_SIZE    ((size_t)1 << 20)
+#define SHORT_MAX           (SHORT_ARENA_SIZE / 8)   /* bigger goes to malloc */
+
+void *short_alloc( size_t bytes );
+void  short_free( void *ptr );
+
+#pragma GCC visibility pop
+
+#endif
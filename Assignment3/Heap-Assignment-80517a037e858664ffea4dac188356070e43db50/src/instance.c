@@ -0,0 +1,264 @@
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "libmalloc.h"
+
+/*
+ * Allocator instances over a caller provided region, e.g. a MAP_SHARED
+ * segment or an mmap'd file.  Every link in the region is an offset from
+ * its start rather than a pointer, so the region works wherever each
+ * process happens to map it, and a spinlock in the region header lets
+ * several processes allocate from it at once.  The allocator itself is
+ * first fit over an address ordered list, with split and coalesce, like
+ * the FF build of malloc.c.
+ */
+
+#define INSTANCE_MAGIC     0x48454150494e5354ULL   /* "HEAPINST" */
+#define ALIGN16(s)         (((s) + 15) & ~(uint64_t)15)
+
+struct _oblock
+{
+    uint64_t size;        /* Size of the _oblock's data in bytes           */
+    uint64_t prev;        /* Offset of the previous _oblock, 0 if none     */
+    uint64_t next;        /* Offset of the next _oblock, 0 if none         */
+    uint32_t free;        /* Is this _oblock free?                         */
+    uint32_t padding;
+};
+
+struct instance
+{
+    uint64_t magic;       /* INSTANCE_MAGIC once formatted                 */
+    uint64_t size;        /* Size of the whole region in bytes             */
+    uint64_t first;       /* Offset of the first _oblock                   */
+    uint64_t root;        /* Offset of the caller's root object, 0 if none */
+    int      lock;        /* Spinlock shared by every attached process     */
+};
+
+#define FIRST_BLOCK        ALIGN16(sizeof(struct instance))
+#define AT(h, off)         ((struct _oblock *)((char *)(h) + (off)))
+#define OFFSET(h, b)       ((uint64_t)((char *)(b) - (char *)(h)))
+#define OBLOCK_DATA(b)     ((void *)((b) + 1))
+#define OBLOCK_HEADER(ptr) ((struct _oblock *)(ptr) - 1)
+
+static void lock(struct instance *h)
+{
+    while (__atomic_exchange_n(&h->lock, 1, __ATOMIC_ACQUIRE))
+    {
+        while (__atomic_load_n(&h->lock, __ATOMIC_RELAXED))
+        {
+            sched_yield();
+        }
+    }
+}
+
+static void unlock(struct instance *h)
+{
+    __atomic_store_n(&h->lock, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * \brief instance_create
+ *
+ * Formats 'size' bytes at 'base' as an empty instance holding one big free
+ * _oblock.  Anything already in the region is lost.
+ *
+ * \param base start of the region, 16 byte aligned
+ * \param size size of the region in bytes
+ *
+ * \return the instance (== base) or NULL if the region is too small
+ */
+struct instance *instance_create(void *base, size_t size)
+{
+    struct instance *h = base;
+
+    if (size < FIRST_BLOCK + sizeof(struct _oblock) + 16)
+    {
+        return NULL;
+    }
+
+    h->size  = size;
+    h->first = FIRST_BLOCK;
+    h->root  = 0;
+    h->lock  = 0;
+
+    struct _oblock *b = AT(h, h->first);
+    b->size = (size - FIRST_BLOCK - sizeof(struct _oblock)) & ~(uint64_t)15;
+    b->prev = 0;
+    b->next = 0;
+    b->free = true;
+
+    __atomic_store_n(&h->magic, INSTANCE_MAGIC, __ATOMIC_RELEASE);
+    return h;
+}
+
+/*
+ * \brief instance_attach
+ *
+ * Uses a region formatted by instance_create(), possibly in another
+ * process or at another address.
+ *
+ * \param base start of the region as mapped in this process
+ *
+ * \return the instance or NULL if the region was never formatted
+ */
+struct instance *instance_attach(void *base)
+{
+    struct instance *h = base;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != INSTANCE_MAGIC)
+    {
+        return NULL;
+    }
+    return h;
+}
+
+/*
+ * \brief instance_alloc
+ *
+ * First fit allocation inside the instance.
+ *
+ * \param h the instance
+ * \param size size of the requested memory in bytes
+ *
+ * \return 16 byte aligned memory inside the region or NULL if it is full
+ */
+void *instance_alloc(struct instance *h, size_t size)
+{
+    if (size == 0)
+    {
+        return NULL;
+    }
+    size = ALIGN16(size);
+
+    lock(h);
+
+    uint64_t off = h->first;
+    struct _oblock *curr = NULL;
+    while (off)
+    {
+        curr = AT(h, off);
+        if (curr->free && curr->size >= size)
+        {
+            break;
+        }
+        off = curr->next;
+    }
+
+    if (off == 0)
+    {
+        unlock(h);
+        return NULL;
+    }
+
+    /* split the _oblock if the rest can hold another one */
+    if (curr->size >= size + sizeof(struct _oblock) + 16)
+    {
+        uint64_t rest_off = off + sizeof(struct _oblock) + size;
+        struct _oblock *rest = AT(h, rest_off);
+        rest->size = curr->size - size - sizeof(struct _oblock);
+        rest->prev = off;
+        rest->next = curr->next;
+        rest->free = true;
+        if (rest->next)
+        {
+            AT(h, rest->next)->prev = rest_off;
+        }
+        curr->size = size;
+        curr->next = rest_off;
+    }
+    curr->free = false;
+
+    unlock(h);
+    return OBLOCK_DATA(curr);
+}
+
+/*
+ * \brief instance_free
+ *
+ * Frees memory from instance_alloc() and coalesces it with free
+ * neighbours.
+ *
+ * \param h the instance
+ * \param ptr the memory to free
+ *
+ * \return none
+ */
+void instance_free(struct instance *h, void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    lock(h);
+
+    struct _oblock *curr = OBLOCK_HEADER(ptr);
+    curr->free = true;
+
+    if (curr->next && AT(h, curr->next)->free)
+    {
+        struct _oblock *next = AT(h, curr->next);
+        curr->size += sizeof(struct _oblock) + next->size;
+        curr->next = next->next;
+        if (curr->next)
+        {
+            AT(h, curr->next)->prev = OFFSET(h, curr);
+        }
+    }
+    if (curr->prev && AT(h, curr->prev)->free)
+    {
+        struct _oblock *prev = AT(h, curr->prev);
+        prev->size += sizeof(struct _oblock) + curr->size;
+        prev->next = curr->next;
+        if (prev->next)
+        {
+            AT(h, prev->next)->prev = curr->prev;
+        }
+    }
+
+    unlock(h);
+}
+
+/*
+ * \brief instance_offset
+ *
+ * \return the offset of ptr from the start of the region, 0 for NULL.
+ * Offsets, not pointers, are what should be stored inside the region.
+ */
+size_t instance_offset(struct instance *h, const void *ptr)
+{
+    return ptr ? (size_t)((const char *)ptr - (const char *)h) : 0;
+}
+
+/*
+ * \brief instance_pointer
+ *
+ * \return the pointer for an offset from instance_offset(), NULL for 0
+ */
+void *instance_pointer(struct instance *h, size_t offset)
+{
+    return offset ? (char *)h + offset : NULL;
+}
+
+/*
+ * \brief instance_set_root
+ *
+ * Records one object other processes can find the rest of the data from.
+ *
+ * \return none
+ */
+void instance_set_root(struct instance *h, void *ptr)
+{
+    __atomic_store_n(&h->root, instance_offset(h, ptr), __ATOMIC_RELEASE);
+}
+
+/*
+ * \brief instance_root
+ *
+ * \return the object recorded by instance_set_root() or NULL
+ */
+void *instance_root(struct instance *h)
+{
+    return instance_pointer(h, __atomic_load_n(&h->root, __ATOMIC_ACQUIRE));
+}
@@ -0,0 +1,200 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "large.h"
+#include "stats.h"
+
+#define PAGE_SIZE           4096
+#define PAGE_ALIGN(s)       (((s) + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1))
+
+#define CACHE_BINS          24                  /* bin k: [2^k, 2^(k+1)) pages */
+#define CACHE_MAX_BYTES     ((size_t)64 << 20)  /* byte budget of the cache   */
+#define CACHE_MAX_AGE       5                   /* seconds a mapping is kept  */
+
+/* Lives in the first bytes of a cached mapping */
+struct _cached
+{
+    struct _cached *bin_next;   /* Next mapping in the same size bin       */
+    struct _cached *bin_prev;   /* Previous mapping in the same size bin   */
+    struct _cached *newer;      /* Next more recently released mapping     */
+    struct _cached *older;      /* Next less recently released mapping     */
+    size_t  bytes;              /* Size of the mapping                     */
+    time_t  released;           /* When large_unmap() parked it            */
+    int     bin;                /* Bin it is on                            */
+};
+
+static struct _cached *bins[CACHE_BINS];
+static struct _cached *newest = NULL;
+static struct _cached *oldest = NULL;
+static size_t cached_bytes = 0;
+
+int num_large_hits        = 0;
+int num_large_misses      = 0;
+long long large_evicted   = 0;
+
+static int binOf(size_t bytes)
+{
+    int bin = 63 - __builtin_clzll(bytes / PAGE_SIZE);
+    return bin < CACHE_BINS ? bin : CACHE_BINS - 1;
+}
+
+static time_t now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+static void unlinkCached(struct _cached *c)
+{
+    if (c->bin_prev)
+    {
+        c->bin_prev->bin_next = c->bin_next;
+    }
+    else
+    {
+        bins[c->bin] = c->bin_next;
+    }
+    if (c->bin_next)
+    {
+        c->bin_next->bin_prev = c->bin_prev;
+    }
+
+    if (c->newer)
+    {
+        c->newer->older = c->older;
+    }
+    else
+    {
+        newest = c->older;
+    }
+    if (c->older)
+    {
+        c->older->newer = c->newer;
+    }
+    else
+    {
+        oldest = c->newer;
+    }
+
+    cached_bytes -= c->bytes;
+}
+
+/*
+ * \brief evict
+ *
+ * Returns the oldest cached mappings to the OS until the cache holds at
+ * most 'budget' bytes and nothing older than CACHE_MAX_AGE.
+ */
+static void evict(size_t budget)
+{
+    time_t cutoff = now() - CACHE_MAX_AGE;
+    while (oldest && (cached_bytes > budget || oldest->released < cutoff))
+    {
+        struct _cached *c = oldest;
+        unlinkCached(c);
+        large_evicted += c->bytes;
+        munmap(c, c->bytes);
+    }
+}
+
+/*
+ * \brief large_map
+ *
+ * Hands out a mapping of at least 'bytes' bytes, reusing a cached one from
+ * the same size bin when possible.
+ *
+ * \param bytes bytes needed including the caller's header
+ * \param mapped receives the real size of the mapping
+ *
+ * \return the mapping or NULL if mmap failed or 'bytes' can't be page aligned
+ */
+void *large_map(size_t bytes, size_t *mapped)
+{
+    if (bytes > SIZE_MAX - (PAGE_SIZE - 1))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    bytes = PAGE_ALIGN(bytes);
+    evict(CACHE_MAX_BYTES);
+
+    struct _cached *c;
+    for (c = bins[binOf(bytes)]; c; c = c->bin_next)
+    {
+        /* same bin means at most twice as big, don't hand out more */
+        if (c->bytes >= bytes && c->bytes - bytes <= bytes / 2)
+        {
+            unlinkCached(c);
+            num_large_hits++;
+            *mapped = c->bytes;
+            return c;
+        }
+    }
+
+    void *ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+    {
+        return NULL;
+    }
+    num_large_misses++;
+    num_grows++;
+    max_heap += bytes;
+    *mapped = bytes;
+    return ptr;
+}
+
+/*
+ * \brief large_unmap
+ *
+ * Parks a mapping from large_map() in the cache, evicting older ones to
+ * stay within the byte budget.  Mappings bigger than the whole budget go
+ * straight back to the OS.
+ *
+ * \param ptr the mapping
+ * \param mapped its size as returned by large_map()
+ *
+ * \return none
+ */
+void large_unmap(void *ptr, size_t mapped)
+{
+    if (mapped > CACHE_MAX_BYTES)
+    {
+        large_evicted += mapped;
+        munmap(ptr, mapped);
+        return;
+    }
+    evict(CACHE_MAX_BYTES - mapped);
+
+    struct _cached *c = ptr;
+    c->bytes = mapped;
+    c->released = now();
+    c->bin = binOf(mapped);
+
+    c->bin_prev = NULL;
+    c->bin_next = bins[c->bin];
+    if (c->bin_next)
+    {
+        c->bin_next->bin_prev = c;
+    }
+    bins[c->bin] = c;
+
+    c->older = newest;
+    c->newer = NULL;
+    if (newest)
+    {
+        newest->newer = c;
+    }
+    else
+    {
+        oldest = c;
+    }
+    newest = c;
+
+    cached_bytes += mapped;
+}
@@ -0,0 +1,22 @@
+#ifndef LARGE_H
+#define LARGE_H
+
+#include <stddef.h>
+
+/*
+ * Large objects bypass the allocator's own heap and get their own mapping.
+ * Released mappings are parked in a small cache, binned by size and aged
+ * out by time and by a byte budget, so a similar sized request soon after
+ * skips mmap, munmap and the page faults in between.
+ */
+
+#pragma GCC visibility push(hidden)
+
+#define LARGE_THRESHOLD     (256 * 1024)        /* bytes, goes to large_map() */
+
+void *large_map( size_t bytes, size_t *mapped );
+void  large_unmap( void *ptr, size_t mapped );
+
+#pragma GCC visibility pop
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef LIBMALLOC_H
+#define LIBMALLOC_H
+
+#include <stddef.h>
+
+/*
+ * Extensions exported by every lib/libmalloc-*.so build on top of the
+ * standard malloc/free/calloc/realloc entry points.
+ */
+
+void printStatistics( void );
+
+/*
+ * Heap walking.  heap_walk() calls fn once per _block of the main heap in
+ * address order with its header address, header and payload sizes and
+ * whether it is in use.  Large and short lived objects live elsewhere and
+ * are not reported.  fn must not allocate.  Builds that cannot walk their
+ * heap report nothing.
+ */
+typedef void (*heap_walker)( void *block, size_t header, size_t size, int used, void *arg );
+
+void heap_walk( heap_walker fn, void *arg );
+
+/*
+ * Capacity.  malloc_usable_size() reports the bytes really available at
+ * ptr, which may exceed the request.  realloc_grow() is realloc() for
+ * append buffers: it keeps ptr while 'min' bytes fit, and otherwise grows
+ * geometrically, or straight to 'hint' (the expected final size, 0 if
+ * unknown) when that is bigger.
+ */
+size_t malloc_usable_size( void *ptr );
+void * realloc_grow( void *ptr, size_t min, size_t hint );
+
+/*
+ * Regions: bump allocation out of large mmap'd chunks.  Individual objects
+ * are never freed; region_reset() releases everything at once in O(1) and
+ * keeps the chunks for reuse, region_destroy() returns them to the OS.
+ */
+struct region;
+
+struct region * region_create( size_t chunk_size );
+void *          region_alloc( struct region *r, size_t size );
+char *          region_strdup( struct region *r, const char *s );
+char *          region_strndup( struct region *r, const char *s, size_t n );
+void            region_reset( struct region *r );
+void            region_destroy( struct region *r );
+
+/*
+ * Batches: n same sized objects for the price of one search.  malloc_batch
+ * fills out[0..n-1] and returns n, or 0 if it could not allocate them all.
+ * free_batch skips NULL entries and coalesces each freed run once.
+ */
+size_t malloc_batch( size_t size, size_t n, void **out );
+void   free_batch( void **ptrs, size_t n );
+
+/*
+ * Lifetime hints.  HINT_SHORT objects go to a separate sub-heap whose
+ * arenas empty out and get trimmed as a whole, so they never end up
+ * wedged between long lived objects.  HINT_LONG (or no hint) is malloc().
+ * Free them with free() as usual.
+ */
+#define HINT_SHORT      1
+#define HINT_LONG       2
+
+void * malloc_hint( size_t size, int hint );
+
+/*
+ * Instances: an allocator over a caller provided region such as a
+ * MAP_SHARED segment or an mmap'd file.  The region only holds offsets,
+ * so any process can instance_attach() it at any address and allocate
+ * from it concurrently.  Store instance_offset()s, not pointers, inside it.
+ */
+struct instance;
+
+struct instance * instance_create( void *base, size_t size );
+struct instance * instance_attach( void *base );
+void *            instance_alloc( struct instance *h, size_t size );
+void              instance_free( struct instance *h, void *ptr );
+size_t            instance_offset( struct instance *h, const void *ptr );
+void *            instance_pointer( struct instance *h, size_t offset );
+void              instance_set_root( struct instance *h, void *ptr );
+void *            instance_root( struct instance *h );
+
+/*
+ * Object caches: fixed size objects from slabs of their own.  ctor runs
+ * once per object when its slab is created and dtor when the slab is
+ * released, so objects stay constructed across cache_free()/cache_alloc();
+ * free them in their constructed state.  Empty slabs are kept until
+ * cache_reap().  Each cache keeps its own statistics, printed with the
+ * heap's.
+ */
+struct cache;
+
+struct cache * cache_create( const char *name, size_t size, size_t align,
+                             void (*ctor)( void * ), void (*dtor)( void * ) );
+void *         cache_alloc( struct cache *c );
+void           cache_free( struct cache *c, void *obj );
+size_t         cache_reap( struct cache *c );
+void           cache_destroy( struct cache *c );
+
+/*
+ * Handles: relocatable objects in a heap of their own.  hlock() pins an
+ * object and returns its address, which stays valid until the matching
+ * hunlock().  Unlocked objects may be slid down by the compactor, which
+ * runs a bounded step at a time inside halloc() and trims the heap top.
+ */
+struct handle;
+
+struct handle * halloc( size_t size );
+void *          hlock( struct handle *h );
+void            hunlock( struct handle *h );
+size_t          hsize( struct handle *h );
+void            hfree( struct handle *h );
+
+#endif
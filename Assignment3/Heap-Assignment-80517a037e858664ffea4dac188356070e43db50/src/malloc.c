@@ -1,57 +1,36 @@
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "decay.h"
+#include "hint.h"
+#include "large.h"
+#include "libmalloc.h"
+#include "stats.h"
+
 #define ALIGN4(s)         (((((s) - 1) >> 2) << 2) + 4)  //making s next multiple of 4
 #define BLOCK_DATA(b)      ((b) + 1)
 #define BLOCK_HEADER(ptr)   ((struct _block *)(ptr) - 1)
 
-
-static int atexit_registered = 0;
-static int num_mallocs       = 0;
-static int num_frees         = 0;
-static int num_reuses        = 0;
-static int num_grows         = 0;
-static int num_splits        = 0;
-static int num_coalesces     = 0;
-static int num_blocks        = 0;
-static int num_requested     = 0;
-static int max_heap          = 0;
-
-/*
- *  \brief printStatistics
- *
- *  \param none
- *
- *  \Prints the heap statistics upon process exit.  Registered
- *  via atexit()
- *
- *  \return none
- */
-void printStatistics( void )
-{
-    printf("\nheap management statistics\n");
-    printf("mallocs:\t%d\n", num_mallocs );
-    printf("frees:\t\t%d\n", num_frees );
-    printf("reuses:\t\t%d\n", num_reuses );
-    printf("grows:\t\t%d\n", num_grows );
-    printf("splits:\t\t%d\n", num_splits );
-    printf("coalesces:\t%d\n", num_coalesces );
-    printf("blocks:\t\t%d\n", num_blocks );
-    printf("requested:\t%d\n", num_requested );
-    printf("max heap:\t%d\n", max_heap );
-}
-
 struct _block
 {
     size_t  size;         /* Size of the allocated _block of memory in bytes */
     struct _block *prev;  /* Pointer to the previous _block of allcated memory   */
     struct _block *next;  /* Pointer to the next _block of allcated memory   */
+#if defined HISTOGRAM
+    int     birth;        /* num_mallocs when this _block was handed out     */
+    unsigned long long birth_ticks; /* read_ticks() when it was handed out   */
+#endif
     bool   free;          /* Is this _block free?                     */
-    char   padding[3];
+    bool   large;         /* Mapped on its own by large_map()?        */
+    bool   short_lived;   /* From the short lived sub-heap?           */
+    bool   grown;         /* Grown by realloc() before?               */
+    unsigned int dirty;   /* decay_epoch() it was freed in, 0 if purged */
 };
 
 struct _block *freeList = NULL, *latest =NULL; /* Free list to track the _blocks available */
@@ -59,7 +38,6 @@ struct _block *freeList = NULL, *latest =NULL; /* Free list to track the _blocks
 /*
  * \brief findFreeBlock
  *
- * \param last pointer to the linked list of free _blocks
  * \param size size of the _block needed in bytes
  *
  * \return a _block that fits the request or NULL if no free _block matches
@@ -68,13 +46,14 @@ struct _block *freeList = NULL, *latest =NULL; /* Free list to track the _blocks
  */
 struct _block *findFreeBlock(size_t size)
 {
-    printf("in find freeblock\n");
     struct _block *curr = freeList;
+    SEARCH_SCOPE();
 
 #if defined FIT && FIT == 0
     /* First fit */
     while (curr && !(curr->free && curr->size >= size))
     {
+        SEARCH_VISIT();
         curr  = curr->next;
     }
 #endif
@@ -83,13 +62,12 @@ struct _block *findFreeBlock(size_t size)
     /* Best fit searches all free blocks and assigns
     min size block that is greater then requested size*/
     struct _block *best = NULL;
-    size_t best_size = (size_t)-1;
-    while (curr && !(curr->free && curr->size >= size))
+    while (curr)
     {
-        if (curr->size < best_size)
+        SEARCH_VISIT();
+        if (curr->free && curr->size >= size && (best == NULL || curr->size < best->size))
         {
             best = curr;
-            best_size = best->size;
         }
         curr = curr->next;
     }
@@ -100,13 +78,12 @@ struct _block *findFreeBlock(size_t size)
     /* Worst fit - searches all free blocks and assigns
     max size block that is greater then requested size*/
     struct _block *worst = NULL;
-    size_t worst_size = (size_t)0;
-    while (curr && !(curr->free && curr->size >= size))
+    while (curr)
     {
-        if (curr->size > worst_size)
+        SEARCH_VISIT();
+        if (curr->free && curr->size >= size && (worst == NULL || curr->size > worst->size))
         {
             worst = curr;
-            worst_size = worst->size;
         }
         curr = curr->next;
     }
@@ -115,28 +92,25 @@ struct _block *findFreeBlock(size_t size)
 
 #if defined NEXT && NEXT == 0
     /* Next fit */
+    struct _block *start;
 
-    if (latest)
+    if (curr == NULL)
     {
-        if (latest->next)  // start search from last assigned memory
-        {
-            curr = latest->next;
-        }
+        return(NULL);
     }
+    if (latest && latest->next)  // start search from last assigned memory
+    {
+        curr = latest->next;
+    }
+    start = curr;
     while (!(curr->free && curr->size >= size))
     {
-        if (curr == latest) // return NULL if free memory not found after a cycle.
+        SEARCH_VISIT();
+        curr = curr->next ? curr->next : freeList;
+        if (curr == start) // return NULL if free memory not found after a cycle.
         {
             return(NULL);
         }
-        if (curr->next)
-        {
-            curr  = curr->next;
-        }
-        else
-        {
-            curr = freeList;
-        }
     }
 #endif
     return curr;
@@ -155,24 +129,22 @@ struct _block *findFreeBlock(size_t size)
  */
 struct _block *growHeap(size_t size)
 {
-    printf("in find growHeap\n");
     /* Request more space from OS */
-    struct _block *last;
+    struct _block *last = freeList;
     struct _block *curr = (struct _block *)sbrk(0);
     struct _block *prev = (struct _block *)sbrk(sizeof(struct _block) + size);
 
-    assert(curr == prev);
-
     /* OS allocation failed */
-    if (curr == (struct _block *)-1)
+    if (prev == (struct _block *)-1)
     {
         return NULL;
     }
 
+    assert(curr == prev);
+
     /* Update freeList if not set */
     if (freeList == NULL)
     {
-        last = NULL;
         freeList = curr;
     }
 
@@ -190,8 +162,9 @@ struct _block *growHeap(size_t size)
     curr->size = size;
     curr->next = NULL;
     curr->free = false;
+    curr->large = false;
+    curr->short_lived = false;
     curr->prev = last;
-    last = curr;
 
     num_grows++;
     num_blocks++;
@@ -210,16 +183,22 @@ struct _block *growHeap(size_t size)
  * \param size - size in bytes that needs to be allocated to curr.
  *  size should be less then then curr->size - sizeof(struct _block)
  *
- * \return returns the newly allocated _block, NULL if failed
+ * \return none
  */
 void split(struct _block *curr, size_t size)
 {
-    printf("in find split\n");
     struct _block *next = (((void *)curr) + (sizeof(struct _block) + size));
     next->size = (curr->size - (sizeof(struct _block) + size));
     next->prev = curr;
     next->next = curr->next;
     next->free = true;
+    next->large = false;
+    next->short_lived = false;
+    next->dirty = curr->free ? curr->dirty : decay_epoch();
+    if (next->next)
+    {
+        next->next->prev = next;
+    }
     curr->size = size;
     curr->next = next;
 
@@ -241,11 +220,20 @@ void split(struct _block *curr, size_t size)
  */
 void *malloc(size_t size)
 {
+    LATENCY_SCOPE(lat_malloc);
+    DECAY_GUARD();
     num_requested += size;
-    if( atexit_registered == 0 )
+    registerStatistics();
+
+#if defined HISTOGRAM
+    size_hist[hist_bucket(size)]++;
+#endif
+
+    /* No mapping can be that big, and ALIGN4 or the header would wrap */
+    if (size > PTRDIFF_MAX)
     {
-        atexit_registered = 1;
-        atexit( printStatistics );
+        errno = ENOMEM;
+        return NULL;
     }
 
     /* Align to multiple of 4 */
@@ -257,6 +245,30 @@ void *malloc(size_t size)
         return NULL;
     }
 
+    /* Large requests get a mapping of their own, outside the _block list */
+    if (size >= LARGE_THRESHOLD)
+    {
+        size_t mapped;
+        struct _block *big = large_map(sizeof(struct _block) + size, &mapped);
+        if (big == NULL)
+        {
+            return NULL;
+        }
+        big->size = mapped - sizeof(struct _block);
+        big->prev = NULL;
+        big->next = NULL;
+        big->free = false;
+        big->large = true;
+        big->short_lived = false;
+        big->grown = false;
+        num_mallocs++;
+#if defined HISTOGRAM
+        big->birth = num_mallocs;
+        big->birth_ticks = read_ticks();
+#endif
+        return BLOCK_DATA(big);
+    }
+
     /* Look for free _block */
     struct _block *next = findFreeBlock(size);
 
@@ -283,11 +295,17 @@ void *malloc(size_t size)
 
     /* Mark _block as in use */
     next->free = false;
+    next->grown = false;
 
     /* Return data address associated with _block */
     latest = next;
     num_mallocs++;
 
+#if defined HISTOGRAM
+    next->birth = num_mallocs;
+    next->birth_ticks = read_ticks();
+#endif
+
     return BLOCK_DATA(next);
 }
 
@@ -303,6 +321,8 @@ void *malloc(size_t size)
  */
 void free(void *ptr)
 {
+    LATENCY_SCOPE(lat_free);
+    DECAY_GUARD();
     if (ptr == NULL)
     {
         return;
@@ -313,16 +333,45 @@ void free(void *ptr)
 
     assert(curr->free == 0);
 
+#if defined HISTOGRAM
+    life_hist[hist_bucket(num_mallocs - curr->birth)]++;
+    tick_hist[hist_bucket(read_ticks() - curr->birth_ticks)]++;
+#endif
+
+    if (curr->large)
+    {
+        large_unmap(curr, sizeof(struct _block) + curr->size);
+        num_frees++;
+        return;
+    }
+    if (curr->short_lived)
+    {
+        short_free(curr);
+        num_frees++;
+        return;
+    }
+
+    /* a merged _block ages like the bigger part of it */
+    unsigned int dirty = decay_epoch();
+
     if (curr->prev)
     {
         if (curr->prev->free) //if previous block is free Coalesce current block with it
         {
+            if (curr->prev->size > curr->size)
+            {
+                dirty = curr->prev->dirty;
+            }
             curr->prev->size += (sizeof(struct _block) + curr->size);
             curr->prev->next = curr->next;
             if (curr->next)
             {
                 curr->next->prev = curr->prev;
             }
+            if (curr == latest)
+            {
+                latest = curr->prev;
+            }
             curr = curr->prev;
 
             num_coalesces++;
@@ -333,22 +382,29 @@ void free(void *ptr)
     {
         if (curr->next->free)  //if next block is free Coalesce it with current block
         {
+            if (curr->next->size > curr->size)
+            {
+                dirty = curr->next->dirty;
+            }
+            if (curr->next == latest)
+            {
+                latest = curr;
+            }
             curr->size += (sizeof(struct _block) + curr->next->size);
             curr->next = curr->next->next;
-            if (curr->prev)
+            if (curr->next)
             {
-                curr->prev->next = curr->next;
+                curr->next->prev = curr;
             }
             num_coalesces++;
             num_blocks--;
         };
     }
     curr->free = true;
-    if (curr == latest) //if we are freeing last allocated block. moving courser to next used block
-    {
-        latest = curr->next;
-    }
+    curr->dirty = dirty;
     num_frees++;
+
+    decay_maybe();
 }
 
 /*
@@ -365,8 +421,15 @@ void free(void *ptr)
  */
 void *calloc(size_t nmemb, size_t size)
 {
+    if (size && nmemb > (size_t)-1 / size)
+    {
+        return NULL;
+    }
     void *ptr = malloc(nmemb*size);
-    memset(ptr, 0, nmemb*size);
+    if (ptr)
+    {
+        memset(ptr, 0, nmemb*size);
+    }
     return (ptr);
 }
 
@@ -381,9 +444,15 @@ void *calloc(size_t nmemb, size_t size)
 * If ptr is NULL, then the call is equivalent to malloc(size), for all values of size;
 * if size is equal to zero, and ptr is not NULL, then the call is equivalent to free(ptr).
 *
+* A _block that realloc() already grew once is treated as an append buffer:
+* the next growth at least doubles it, and shrinking it by less than half
+* keeps the spare capacity, so repeated appends cost amortized O(1) copies.
+* malloc_usable_size() reports the capacity.
 */
 void *realloc(void *ptr, size_t size)
 {
+    LATENCY_SCOPE(lat_realloc);
+    DECAY_GUARD();
     struct _block *curr;
     if (ptr)
     {
@@ -398,19 +467,69 @@ void *realloc(void *ptr, size_t size)
         if (size == 0)
         {
             free(ptr);
+            return NULL;
+        }
+        if (size > PTRDIFF_MAX)
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+        size = ALIGN4(size);
+        bool growing = size > curr->size;
+        if (curr->grown)
+        {
+            if (!growing && size > curr->size / 2)
+            {
+                // keep the spare capacity for the next append.
+                return ptr;
+            }
+            if (growing && size < curr->size * 2)
+            {
+                // grown before, over-provision geometrically.
+                size = ALIGN4(curr->size * 2);
+            }
+        }
+        if (curr->large || curr->short_lived)
+        {
+            // not in the _block list, only keep it if it is still big enough.
+            if (curr->size < size)
+            {
+                newptr = malloc(size);
+                if (newptr == NULL)
+                {
+                    return NULL;
+                }
+                memcpy (newptr, ptr, curr->size);
+                free(ptr);
+                BLOCK_HEADER(newptr)->grown = true;
+                num_realloc_moves++;
+                return (newptr);
+            }
         }
         else if ((curr->size) > (sizeof(struct _block) + size))
         {
             split(curr, size);
         }
-        else if (curr->next && curr->next->free && curr->next->size >= size - (curr->size + sizeof(struct _block)))
+        else if (curr->size >= size)
+        {
+            // already big enough, nothing to do.
+        }
+        else if (curr->next && curr->next->free &&
+                 curr->size + sizeof(struct _block) + curr->next->size >= size)
         {
+            // absorb the free neighbour.
+            if (curr->next == latest)
+            {
+                latest = curr;
+            }
+            curr->size += (curr->next->size + sizeof(struct _block));
             curr->next = curr->next->next;
             if (curr->next)
             {
-                curr->next->prev = curr->prev;
+                curr->next->prev = curr;
             }
-            curr->size += (curr->next->size + sizeof(struct _block));
+            num_coalesces++;
+            num_blocks--;
 
             // if merged block is bigger then requested size split it.
             if ((curr->size) > (sizeof(struct _block) + size))
@@ -421,10 +540,21 @@ void *realloc(void *ptr, size_t size)
         else //next block is not free. free the block and assign a new block of requested size.
         {
             newptr = malloc(size);
+            if (newptr == NULL)
+            {
+                return NULL;
+            }
             memcpy (newptr, ptr, curr->size);
             free(ptr);
+            BLOCK_HEADER(newptr)->grown = true;
+            num_realloc_moves++;
             return (newptr);
         }
+
+        if (growing)
+        {
+            curr->grown = true;
+        }
     }
     else //if requested ptr is NULL assign a new block with requested size.
     {
@@ -434,4 +564,299 @@ void *realloc(void *ptr, size_t size)
     return BLOCK_DATA(curr);
 }
 
+/*
+ * \brief malloc_usable_size
+ *
+ * \return the bytes that can be used at ptr, at least what was asked for
+ */
+size_t malloc_usable_size(void *ptr)
+{
+    return ptr ? BLOCK_HEADER(ptr)->size : 0;
+}
+
+/*
+ * \brief malloc_batch
+ *
+ * Allocates n objects of the same size with a single search.  One free
+ * _block (or one growHeap) big enough for the whole run is carved into n
+ * _blocks by a sequence of splits, so the objects end up contiguous.
+ *
+ * \param size size of each object in bytes
+ * \param n number of objects
+ * \param out receives the n pointers
+ *
+ * \return n on success, 0 if the run could not be allocated
+ */
+size_t malloc_batch(size_t size, size_t n, void **out)
+{
+    LATENCY_SCOPE(lat_malloc_batch);
+    DECAY_GUARD();
+    size_t i;
+
+    num_requested += size * n;
+    registerStatistics();
+
+    /* Align to multiple of 4 */
+    size = ALIGN4(size);
+
+    if (size == 0 || n == 0)
+    {
+        return 0;
+    }
+
+    /* n * (header + size) must not wrap, nor pass the intptr_t sbrk() takes */
+    if (size > PTRDIFF_MAX - sizeof(struct _block) ||
+        n > (PTRDIFF_MAX - sizeof(struct _block)) / (sizeof(struct _block) + size))
+    {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    size_t run = n * (sizeof(struct _block) + size) - sizeof(struct _block);
+
+    /* Look for one free _block that holds the whole run */
+    struct _block *curr = findFreeBlock(run);
+    if (curr == NULL)
+    {
+        curr = growHeap(run);
+        if (curr == NULL)
+        {
+            return 0;
+        }
+    }
+    else
+    {
+        if (curr->size > sizeof(struct _block) + run)
+        {
+            split(curr, run);
+        }
+        num_reuses += n;
+    }
+
+    /* Carve the run into n _blocks */
+    for (i = 0; i < n; i++)
+    {
+        if (i + 1 < n)
+        {
+            split(curr, size);
+        }
+        curr->free = false;
+        curr->grown = false;
+#if defined HISTOGRAM
+        size_hist[hist_bucket(size)]++;
+        curr->birth = num_mallocs + i + 1;
+        curr->birth_ticks = read_ticks();
+#endif
+        out[i] = BLOCK_DATA(curr);
+        latest = curr;
+        curr = curr->next;
+    }
+    num_mallocs += n;
+
+    return n;
+}
+
+/*
+ * \brief free_batch
+ *
+ * Frees n objects.  All of them are marked free first and each run of
+ * adjacent free _blocks is then coalesced once, front to back, instead of
+ * merging neighbour by neighbour on every free().
+ *
+ * \param ptrs the objects to free, NULL entries are skipped
+ * \param n number of entries in ptrs
+ *
+ * \return none
+ */
+void free_batch(void **ptrs, size_t n)
+{
+    LATENCY_SCOPE(lat_free_batch);
+    DECAY_GUARD();
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (ptrs[i] == NULL)
+        {
+            continue;
+        }
+        struct _block *curr = BLOCK_HEADER(ptrs[i]);
+        assert(curr->free == 0);
+        if (curr->large || curr->short_lived)
+        {
+            continue;
+        }
+#if defined HISTOGRAM
+        life_hist[hist_bucket(num_mallocs - curr->birth)]++;
+        tick_hist[hist_bucket(read_ticks() - curr->birth_ticks)]++;
+#endif
+        curr->free = true;
+        num_frees++;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (ptrs[i] == NULL)
+        {
+            continue;
+        }
+        struct _block *curr = BLOCK_HEADER(ptrs[i]);
+
+        /* not part of any run, releasing them is safe here */
+        if (curr->large || curr->short_lived)
+        {
+            free(ptrs[i]);
+            continue;
+        }
+
+        /* already swallowed by an earlier run, its header was zeroed */
+        if (curr->size == 0)
+        {
+            continue;
+        }
+
+        /* rewind to the first free _block of this run */
+        while (curr->prev && curr->prev->free)
+        {
+            curr = curr->prev;
+        }
+
+        /* and merge everything free after it */
+        while (curr->next && curr->next->free)
+        {
+            struct _block *next = curr->next;
+            if (next == latest)
+            {
+                latest = curr;
+            }
+            curr->size += sizeof(struct _block) + next->size;
+            curr->next = next->next;
+            if (curr->next)
+            {
+                curr->next->prev = curr;
+            }
+            next->size = 0;
+
+            num_coalesces++;
+            num_blocks--;
+        }
+        curr->dirty = decay_epoch();
+    }
+
+    decay_maybe();
+}
+
+/*
+ * \brief malloc_hint
+ *
+ * malloc() with a lifetime hint.  Small HINT_SHORT requests are carved from
+ * the short lived sub-heap instead of the _block list, everything else is
+ * a plain malloc().
+ *
+ * \param size size of the requested memory in bytes
+ * \param hint HINT_SHORT or HINT_LONG
+ *
+ * \return returns the requested memory allocation or NULL if failed
+ */
+void *malloc_hint(size_t size, int hint)
+{
+    DECAY_GUARD();
+    if (!(hint & HINT_SHORT) || size == 0 ||
+        sizeof(struct _block) + ALIGN4(size) > SHORT_MAX)
+    {
+        return malloc(size);
+    }
+
+    num_requested += size;
+    registerStatistics();
+
+#if defined HISTOGRAM
+    size_hist[hist_bucket(size)]++;
+#endif
+
+    size = ALIGN4(size);
+    struct _block *curr = short_alloc(sizeof(struct _block) + size);
+    if (curr == NULL)
+    {
+        return NULL;
+    }
+    curr->size = size;
+    curr->prev = NULL;
+    curr->next = NULL;
+    curr->free = false;
+    curr->large = false;
+    curr->short_lived = true;
+    curr->grown = false;
+    num_mallocs++;
+
+#if defined HISTOGRAM
+    curr->birth = num_mallocs;
+    curr->birth_ticks = read_ticks();
+#endif
+
+    return BLOCK_DATA(curr);
+}
+
+/*
+ * \brief heap_walk
+ *
+ * Reports every _block on the list, i.e. the whole sbrk heap in order.
+ *
+ * \return none
+ */
+void heap_walk(heap_walker fn, void *arg)
+{
+    struct _block *curr;
+    for (curr = freeList; curr; curr = curr->next)
+    {
+        fn(curr, sizeof(struct _block), curr->size, !curr->free, arg);
+    }
+}
+
+/*
+ * \brief decayForEach
+ *
+ * Visits the free _blocks for decay purging.
+ *
+ * \return none
+ */
+void decayForEach(decay_visit fn, void *arg)
+{
+    struct _block *curr;
+    for (curr = freeList; curr; curr = curr->next)
+    {
+        if (curr->free)
+        {
+            fn(&curr->dirty, BLOCK_DATA(curr), curr->size, arg);
+        }
+    }
+}
+
+/*
+ * \brief heapFreeSpace
+ *
+ * Sums up the free _blocks for the fragmentation statistics.
+ *
+ * \param free_bytes receives the bytes in free _blocks
+ * \param largest_free receives the size of the biggest free _block
+ *
+ * \return none
+ */
+void heapFreeSpace(size_t *free_bytes, size_t *largest_free)
+{
+    struct _block *curr;
 
+    *free_bytes = 0;
+    *largest_free = 0;
+    for (curr = freeList; curr; curr = curr->next)
+    {
+        if (curr->free)
+        {
+            *free_bytes += curr->size;
+            if (curr->size > *largest_free)
+            {
+                *largest_free = curr->size;
+            }
+        }
+    }
+}
@@ -0,0 +1,205 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "libmalloc.h"
+
+#define REGION_ALIGNMENT     16
+#define REGION_ALIGN(s)      (((s) + REGION_ALIGNMENT - 1) & ~(size_t)(REGION_ALIGNMENT - 1))   //making s next multiple of 16
+#define REGION_CHUNK_SIZE    (64 * 1024)                 /* default chunk size */
+
+struct _chunk
+{
+    struct _chunk *next;  /* Next chunk owned by the region            */
+    size_t  size;         /* Total size of the mapping in bytes        */
+    size_t  used;         /* Offset of the first unused byte           */
+};
+
+struct region
+{
+    struct _chunk *head;  /* First chunk, also holds this struct       */
+    struct _chunk *curr;  /* Chunk we are currently bumping in         */
+    size_t  chunk_size;   /* Size of each new chunk in bytes           */
+};
+
+#define CHUNK_START        REGION_ALIGN(sizeof(struct _chunk))
+
+/*
+ * \brief newChunk
+ *
+ * Maps a fresh chunk big enough for at least 'size' bytes of payload.
+ *
+ * \param chunk_size the region's preferred chunk size
+ * \param size payload bytes that must fit after the chunk header
+ *
+ * \return the new chunk or NULL if mmap failed
+ */
+static struct _chunk *newChunk(size_t chunk_size, size_t size)
+{
+    size_t bytes = CHUNK_START + size;
+    if (bytes < chunk_size)
+    {
+        bytes = chunk_size;
+    }
+
+    struct _chunk *chunk = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED)
+    {
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->size = bytes;
+    chunk->used = CHUNK_START;
+    return chunk;
+}
+
+/*
+ * \brief region_create
+ *
+ * Creates an empty region.  The region header lives in its first chunk so
+ * creating one does not touch the malloc heap.
+ *
+ * \param chunk_size size of each chunk in bytes, 0 for the default
+ *
+ * \return the new region or NULL if failed
+ */
+struct region *region_create(size_t chunk_size)
+{
+    if (chunk_size == 0)
+    {
+        chunk_size = REGION_CHUNK_SIZE;
+    }
+
+    struct _chunk *chunk = newChunk(chunk_size, sizeof(struct region));
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+
+    struct region *r = (struct region *)((char *)chunk + chunk->used);
+    chunk->used += REGION_ALIGN(sizeof(struct region));
+
+    r->head = chunk;
+    r->curr = chunk;
+    r->chunk_size = chunk_size;
+    return r;
+}
+
+/*
+ * \brief region_alloc
+ *
+ * Bump allocates 'size' bytes from the region.  Moves on to the next kept
+ * chunk, or maps a new one, when the current chunk is full.
+ *
+ * \param r the region
+ * \param size size of the requested memory in bytes
+ *
+ * \return 16 byte aligned memory or NULL if failed
+ */
+void *region_alloc(struct region *r, size_t size)
+{
+    struct _chunk *chunk = r->curr;
+
+    /* Neither the alignment nor newChunk()'s header may wrap */
+    if (size > SIZE_MAX - CHUNK_START - (REGION_ALIGNMENT - 1))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size = REGION_ALIGN(size);
+    if (size == 0)
+    {
+        return NULL;
+    }
+
+    while (size > chunk->size - chunk->used)
+    {
+        if (chunk->next == NULL)
+        {
+            struct _chunk *fresh = newChunk(r->chunk_size, size);
+            if (fresh == NULL)
+            {
+                return NULL;
+            }
+            chunk->next = fresh;
+        }
+        // chunks past curr are left over from before a reset, rewind them as we go.
+        chunk = chunk->next;
+        chunk->used = CHUNK_START;
+    }
+    r->curr = chunk;
+
+    void *ptr = (char *)chunk + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+/*
+ * \brief region_strdup
+ *
+ * strdup() into the region.
+ *
+ * \return the copy or NULL if failed
+ */
+char *region_strdup(struct region *r, const char *s)
+{
+    return region_strndup(r, s, strlen(s));
+}
+
+/*
+ * \brief region_strndup
+ *
+ * strndup() into the region.
+ *
+ * \return the copy or NULL if failed
+ */
+char *region_strndup(struct region *r, const char *s, size_t n)
+{
+    size_t len = strnlen(s, n);
+    char *copy = region_alloc(r, len + 1);
+    if (copy)
+    {
+        memcpy(copy, s, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+/*
+ * \brief region_reset
+ *
+ * Frees every object in the region at once.  The chunks are kept and
+ * rewound lazily by region_alloc(), so this is O(1).
+ *
+ * \param r the region
+ *
+ * \return none
+ */
+void region_reset(struct region *r)
+{
+    r->curr = r->head;
+    r->head->used = CHUNK_START + REGION_ALIGN(sizeof(struct region));
+}
+
+/*
+ * \brief region_destroy
+ *
+ * Returns all of the region's chunks to the OS.  The region must not be
+ * used afterwards.
+ *
+ * \param r the region
+ *
+ * \return none
+ */
+void region_destroy(struct region *r)
+{
+    struct _chunk *chunk = r->head;
+    while (chunk)
+    {
+        struct _chunk *next = chunk->next;
+        munmap(chunk, chunk->size);
+        chunk = next;
+    }
+}
@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#if defined __x86_64__ || defined __i386__
+#include <x86intrin.h>
+#endif
+
+#include "decay.h"
+#include "libmalloc.h"
+#include "stats.h"
+
+static int atexit_registered = 0;
+int num_mallocs       = 0;
+int num_frees         = 0;
+int num_reuses        = 0;
+int num_grows         = 0;
+int num_splits        = 0;
+int num_coalesces     = 0;
+int num_blocks        = 0;
+int num_requested     = 0;
+int max_heap          = 0;
+int num_realloc_moves = 0;
+
+#if defined HISTOGRAM
+int size_hist[HIST_BUCKETS];
+int life_hist[HIST_BUCKETS];
+int tick_hist[HIST_BUCKETS];
+
+/*
+ * \brief printHistogram
+ *
+ * Prints the non empty buckets of a log2 histogram.
+ *
+ * \param title heading printed above the buckets
+ * \param hist  bucket counts
+ *
+ * \return none
+ */
+static void printHistogram( const char *title, const int *hist )
+{
+    int i;
+    printf("\n%s\n", title);
+    for (i = 0; i < HIST_BUCKETS; i++)
+    {
+        if (hist[i] == 0)
+        {
+            continue;
+        }
+        unsigned long long lo = i ? 1ULL << (i - 1) : 0;
+        unsigned long long hi = 1ULL << i;
+        if (i == HIST_BUCKETS - 1)
+        {
+            printf("[%llu, inf):\t%d\n", lo, hist[i]);
+        }
+        else
+        {
+            printf("[%llu, %llu):\t%d\n", lo, hi, hist[i]);
+        }
+    }
+}
+#endif
+
+#if defined LATENCY
+/*
+ * HDR style histograms: values below LAT_SUB are exact, above that every
+ * power of two is cut into LAT_SUB linear sub-buckets, so a bucket is
+ * never off by more than 1/LAT_SUB of its value.  Each thread records into
+ * its own set, linked into a global list and merged when printing.
+ */
+#define LAT_SUB_BITS      3
+#define LAT_SUB           (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS       ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+enum { LAT_MALLOC, LAT_FREE, LAT_REALLOC, LAT_MALLOC_BATCH, LAT_FREE_BATCH,
+       LAT_SEARCH, LAT_OPS };
+
+static const char *lat_names[LAT_OPS] =
+{
+    "malloc (ticks)", "free (ticks)", "realloc (ticks)",
+    "malloc_batch (ticks)", "free_batch (ticks)", "search (nodes)"
+};
+
+struct _lat
+{
+    unsigned long long count[LAT_OPS][LAT_BUCKETS];
+    unsigned long long max[LAT_OPS];
+    struct _lat *next;
+};
+
+static struct _lat *lat_threads = NULL;
+static __thread struct _lat *lat_mine __attribute__((tls_model("initial-exec")));
+
+static int lat_bucket( unsigned long long value )
+{
+    if (value < LAT_SUB)
+    {
+        return value;
+    }
+    int e = 63 - __builtin_clzll(value);
+    int sub = (value >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1);
+    return (e - LAT_SUB_BITS + 1) * LAT_SUB + sub;
+}
+
+/* highest value that lands in the bucket */
+static unsigned long long lat_value( int bucket )
+{
+    if (bucket < LAT_SUB)
+    {
+        return bucket;
+    }
+    int e = bucket / LAT_SUB + LAT_SUB_BITS - 1;
+    unsigned long long sub = bucket % LAT_SUB;
+    return ((LAT_SUB + sub + 1) << (e - LAT_SUB_BITS)) - 1;
+}
+
+/*
+ * \brief lat_record
+ *
+ * Adds a sample to the calling thread's histogram, mapping it on first use.
+ * The mapping comes straight from mmap() since we cannot malloc() here.
+ *
+ * \return none
+ */
+static void lat_record( int op, unsigned long long value )
+{
+    struct _lat *l = lat_mine;
+    if (l == NULL)
+    {
+        l = mmap(NULL, sizeof(struct _lat), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (l == MAP_FAILED)
+        {
+            return;
+        }
+        l->next = __atomic_load_n(&lat_threads, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&lat_threads, &l->next, l, false,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+        }
+        lat_mine = l;
+    }
+    l->count[op][lat_bucket(value)]++;
+    if (value > l->max[op])
+    {
+        l->max[op] = value;
+    }
+}
+
+void lat_malloc_done( unsigned long long *start )
+{
+    lat_record(LAT_MALLOC, read_ticks() - *start);
+}
+
+void lat_free_done( unsigned long long *start )
+{
+    lat_record(LAT_FREE, read_ticks() - *start);
+}
+
+void lat_realloc_done( unsigned long long *start )
+{
+    lat_record(LAT_REALLOC, read_ticks() - *start);
+}
+
+void lat_malloc_batch_done( unsigned long long *start )
+{
+    lat_record(LAT_MALLOC_BATCH, read_ticks() - *start);
+}
+
+void lat_free_batch_done( unsigned long long *start )
+{
+    lat_record(LAT_FREE_BATCH, read_ticks() - *start);
+}
+
+void lat_search_done( unsigned long long *visited )
+{
+    lat_record(LAT_SEARCH, *visited);
+}
+
+/*
+ * \brief printLatency
+ *
+ * Merges every thread's histograms and prints count, percentiles and max
+ * for each operation that was recorded.
+ *
+ * \return none
+ */
+static void printLatency( void )
+{
+    static const double pct[] = { 50, 90, 99, 99.9 };
+    static unsigned long long merged[LAT_BUCKETS];
+    struct _lat *l;
+    int op, i, p;
+
+    printf("\nlatency\t\t\tcount\tp50\tp90\tp99\tp99.9\tmax\n");
+    for (op = 0; op < LAT_OPS; op++)
+    {
+        unsigned long long total = 0, max = 0;
+        memset(merged, 0, sizeof(merged));
+        for (l = __atomic_load_n(&lat_threads, __ATOMIC_ACQUIRE); l; l = l->next)
+        {
+            for (i = 0; i < LAT_BUCKETS; i++)
+            {
+                merged[i] += l->count[op][i];
+                total += l->count[op][i];
+            }
+            if (l->max[op] > max)
+            {
+                max = l->max[op];
+            }
+        }
+        if (total == 0)
+        {
+            continue;
+        }
+
+        printf("%-16s\t%llu", lat_names[op], total);
+        unsigned long long seen = 0;
+        for (i = 0, p = 0; i < LAT_BUCKETS && p < 4; i++)
+        {
+            seen += merged[i];
+            while (p < 4 && seen * 100.0 >= total * pct[p])
+            {
+                unsigned long long v = lat_value(i);
+                printf("\t%llu", v < max ? v : max);
+                p++;
+            }
+        }
+        printf("\t%llu\n", max);
+    }
+}
+#endif
+
+/*
+ * \brief read_ticks
+ *
+ * Cheap monotonic time stamp.  Uses the TSC on x86 and falls back to
+ * CLOCK_MONOTONIC nanoseconds elsewhere.
+ *
+ * \return current tick count
+ */
+unsigned long long read_ticks( void )
+{
+#if defined __x86_64__ || defined __i386__
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+ * \brief hist_bucket
+ *
+ * Maps a value to its log2 histogram bucket.  Bucket 0 holds 0,
+ * bucket k holds [2^(k-1), 2^k).  The last bucket absorbs everything larger.
+ *
+ * \param value value to classify
+ *
+ * \return bucket index
+ */
+int hist_bucket( unsigned long long value )
+{
+    int bucket = 0;
+    if (value)
+    {
+        bucket = 64 - __builtin_clzll(value);
+    }
+    return (bucket < HIST_BUCKETS) ? bucket : HIST_BUCKETS - 1;
+}
+
+/*
+ *  \brief printStatistics
+ *
+ *  \param none
+ *
+ *  \Prints the heap statistics upon process exit.  Registered
+ *  via atexit()
+ *
+ *  \return none
+ */
+void printStatistics( void )
+{
+    printf("\nheap management statistics\n");
+    printf("mallocs:\t%d\n", num_mallocs );
+    printf("frees:\t\t%d\n", num_frees );
+    printf("reuses:\t\t%d\n", num_reuses );
+    printf("grows:\t\t%d\n", num_grows );
+    printf("splits:\t\t%d\n", num_splits );
+    printf("coalesces:\t%d\n", num_coalesces );
+    printf("blocks:\t\t%d\n", num_blocks );
+    printf("requested:\t%d\n", num_requested );
+    printf("max heap:\t%d\n", max_heap );
+    printf("realloc moves:\t%d\n", num_realloc_moves );
+    printf("large hits:\t%d\n", num_large_hits );
+    printf("large misses:\t%d\n", num_large_misses );
+    printf("large evicted:\t%lld\n", large_evicted );
+    printf("short arenas:\t%d\n", num_short_arenas );
+    printf("short trims:\t%d\n", num_short_trims );
+    printf("dirty bytes:\t%lld\n", decay_dirty_bytes() );
+    printf("purged bytes:\t%lld\n", decay_purged );
+    printf("handle moves:\t%d\n", num_handle_moves );
+    printf("handle trimmed:\t%lld\n", handle_trimmed );
+
+    size_t free_bytes, largest_free;
+    heapFreeSpace(&free_bytes, &largest_free);
+    printf("free bytes:\t%zu\n", free_bytes );
+    printf("largest free:\t%zu\n", largest_free );
+    printf("fragmentation:\t%d%%\n", free_bytes ? (int)(100 - largest_free * 100 / free_bytes) : 0 );
+
+    printCaches();
+
+#if defined HISTOGRAM
+    printHistogram("request size histogram (bytes)", size_hist);
+    printHistogram("lifetime histogram (mallocs elapsed)", life_hist);
+    printHistogram("lifetime histogram (ticks)", tick_hist);
+#endif
+
+#if defined LATENCY
+    printLatency();
+#endif
+}
+
+/*
+ * \brief heap_walk
+ *
+ * Fallback for builds that cannot walk their heap, reports nothing.
+ * malloc.c and buddy.c override it.
+ *
+ * \return none
+ */
+__attribute__((weak)) void heap_walk( heap_walker fn, void *arg )
+{
+}
+
+/*
+ *  \brief registerStatistics
+ *
+ *  Registers printStatistics() with atexit() the first time it is called.
+ *
+ *  \return none
+ */
+void registerStatistics( void )
+{
+    if( atexit_registered == 0 )
+    {
+        atexit_registered = 1;
+        atexit( printStatistics );
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef STATS_H
+#define STATS_H
+
+/*
+ * Heap statistics shared by every allocator build.  Internal to the
+ * library, the symbols are hidden so they never clash with the program
+ * we are preloaded into.
+ */
+
+#include <stddef.h>
+
+#pragma GCC visibility push(hidden)
+
+#define HIST_BUCKETS      40   /* log2 buckets: [0], [1], [2,4), [4,8) ... */
+
+extern int num_mallocs;
+extern int num_frees;
+extern int num_reuses;
+extern int num_grows;
+extern int num_splits;
+extern int num_coalesces;
+extern int num_blocks;
+extern int num_requested;
+extern int max_heap;
+extern int num_realloc_moves;         /* realloc() calls that copied the data  */
+
+extern int num_large_hits;            /* large_map() served from the cache     */
+extern int num_large_misses;          /* large_map() had to mmap               */
+extern long long large_evicted;       /* bytes the cache gave back to the OS   */
+
+extern int num_short_arenas;          /* short lived arenas currently mapped   */
+extern int num_short_trims;           /* short lived arenas emptied and trimmed */
+
+extern long long decay_purged;        /* free bytes madvise()d by decay        */
+
+extern int num_handle_moves;          /* objects the handle compactor moved    */
+extern long long handle_trimmed;      /* bytes trimmed off the handle heap top */
+
+#if defined HISTOGRAM
+extern int size_hist[HIST_BUCKETS];   /* requested sizes in bytes              */
+extern int life_hist[HIST_BUCKETS];   /* lifetimes in mallocs elapsed          */
+extern int tick_hist[HIST_BUCKETS];   /* lifetimes in ticks (TSC or ns)        */
+#endif
+
+#if defined LATENCY
+/*
+ * Per operation latency in ticks.  LATENCY_SCOPE(op) at the top of an entry
+ * point times it up to whichever return it takes; SEARCH_VISIT() counts
+ * one free list node looked at by the current search.
+ */
+#define LATENCY_SCOPE(op)  unsigned long long lat_start \
+                               __attribute__((cleanup(op##_done))) = read_ticks()
+#define SEARCH_SCOPE()     unsigned long long lat_visited \
+                               __attribute__((cleanup(lat_search_done))) = 0
+#define SEARCH_VISIT()     (lat_visited++)
+
+void lat_malloc_done( unsigned long long *start );
+void lat_free_done( unsigned long long *start );
+void lat_realloc_done( unsigned long long *start );
+void lat_malloc_batch_done( unsigned long long *start );
+void lat_free_batch_done( unsigned long long *start );
+void lat_search_done( unsigned long long *visited );
+#else
+#define LATENCY_SCOPE(op)
+#define SEARCH_SCOPE()
+#define SEARCH_VISIT()     ((void)0)
+#endif
+
+void               registerStatistics( void );
+void               heapFreeSpace( size_t *free_bytes, size_t *largest_free );
+void               printCaches( void );
+unsigned long long read_ticks( void );
+int                hist_bucket( unsigned long long value );
+
+#pragma GCC visibility pop
+
+#endif
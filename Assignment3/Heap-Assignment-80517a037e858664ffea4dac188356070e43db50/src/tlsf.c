@@ -0,0 +1,549 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "large.h"
+#include "libmalloc.h"
+#include "stats.h"
+
+/*
+ * Two level segregated fit allocator, built with -DTLSF=0.
+ *
+ * Free blocks are kept on FL_COUNT x SL_COUNT lists.  The first level splits
+ * sizes by power of two, the second level splits each power of two range
+ * into SL_COUNT equal slices.  One bitmap says which first level rows have
+ * any free block and one bitmap per row says which of its lists are non
+ * empty, so finding a good fit is two ffs() calls and malloc/free never
+ * walk a list: both are O(1).  Requests of LARGE_THRESHOLD bytes and up
+ * are mapped on their own through large_map().
+ */
+
+#define ALIGN_SHIFT      3
+#define ALIGN_SIZE       ((size_t)1 << ALIGN_SHIFT)
+#define ALIGN8(s)        (((s) + ALIGN_SIZE - 1) & ~(ALIGN_SIZE - 1))
+
+#define SL_LOG2          4
+#define SL_COUNT         (1 << SL_LOG2)
+#define FL_SHIFT         (SL_LOG2 + ALIGN_SHIFT)
+#define FL_MAX           38                          /* 32 rows, fits fl_bitmap */
+#define FL_COUNT         (FL_MAX - FL_SHIFT + 1)
+#define SMALL_SIZE       ((size_t)1 << FL_SHIFT)     /* below this fl is 0    */
+#define MAX_SIZE         (((size_t)1 << FL_MAX) - ALIGN_SIZE) /* last row, larger is refused */
+
+#define POOL_SIZE        ((size_t)1 << 20)           /* minimum pool mapping  */
+
+#define BLOCK_FREE       ((size_t)1)
+#define BLOCK_PREV_FREE  ((size_t)2)
+#define BLOCK_LARGE      ((size_t)4)                 /* from large_map()      */
+#define SIZE_MASK        (~(BLOCK_FREE | BLOCK_PREV_FREE | BLOCK_LARGE))
+
+struct _block
+{
+    struct _block *prev_phys; /* Physically preceding _block, NULL at pool start */
+    size_t  size;             /* Payload size in bytes, low bits are flags       */
+#if defined HISTOGRAM
+    int     birth;            /* num_mallocs when this _block was handed out     */
+    unsigned long long birth_ticks; /* read_ticks() when it was handed out       */
+#endif
+    struct _block *next_free; /* Next free _block in this list, free only        */
+    struct _block *prev_free; /* Previous free _block in this list, free only    */
+};
+
+#define HEADER_SIZE        offsetof(struct _block, next_free)
+#define MIN_BLOCK          (sizeof(struct _block) - HEADER_SIZE)
+#define BLOCK_DATA(b)      ((void *)((char *)(b) + HEADER_SIZE))
+#define BLOCK_HEADER(ptr)  ((struct _block *)((char *)(ptr) - HEADER_SIZE))
+
+static unsigned int   fl_bitmap = 0;
+static unsigned int   sl_bitmap[FL_COUNT];
+static struct _block *freeLists[FL_COUNT][SL_COUNT];
+
+static inline size_t blockSize(struct _block *b)
+{
+    return b->size & SIZE_MASK;
+}
+
+static inline struct _block *nextPhys(struct _block *b)
+{
+    return (struct _block *)((char *)BLOCK_DATA(b) + blockSize(b));
+}
+
+static inline int fls_size(size_t size)
+{
+    return 63 - __builtin_clzll(size);
+}
+
+/*
+ * \brief mapping
+ *
+ * Computes the list a free _block of 'size' bytes belongs to.
+ */
+static void mapping(size_t size, int *fl, int *sl)
+{
+    if (size < SMALL_SIZE)
+    {
+        *fl = 0;
+        *sl = (int)(size >> ALIGN_SHIFT) & (SL_COUNT - 1);
+    }
+    else
+    {
+        int f = fls_size(size);
+        *sl = (int)(size >> (f - SL_LOG2)) ^ SL_COUNT;
+        *fl = f - FL_SHIFT + 1;
+    }
+}
+
+/*
+ * \brief mappingSearch
+ *
+ * Like mapping() but rounds the size up to the next list boundary, so that
+ * every _block on the returned list is big enough without searching it.
+ */
+static void mappingSearch(size_t size, int *fl, int *sl)
+{
+    if (size >= SMALL_SIZE)
+    {
+        size += ((size_t)1 << (fls_size(size) - SL_LOG2)) - 1;
+    }
+    mapping(size, fl, sl);
+}
+
+static void insertFree(struct _block *b)
+{
+    int fl, sl;
+    mapping(blockSize(b), &fl, &sl);
+
+    b->prev_free = NULL;
+    b->next_free = freeLists[fl][sl];
+    if (b->next_free)
+    {
+        b->next_free->prev_free = b;
+    }
+    freeLists[fl][sl] = b;
+    fl_bitmap |= 1U << fl;
+    sl_bitmap[fl] |= 1U << sl;
+}
+
+static void removeFree(struct _block *b)
+{
+    int fl, sl;
+    mapping(blockSize(b), &fl, &sl);
+
+    if (b->prev_free)
+    {
+        b->prev_free->next_free = b->next_free;
+    }
+    else
+    {
+        freeLists[fl][sl] = b->next_free;
+        if (b->next_free == NULL)
+        {
+            sl_bitmap[fl] &= ~(1U << sl);
+            if (sl_bitmap[fl] == 0)
+            {
+                fl_bitmap &= ~(1U << fl);
+            }
+        }
+    }
+    if (b->next_free)
+    {
+        b->next_free->prev_free = b->prev_free;
+    }
+}
+
+/*
+ * \brief findFreeBlock
+ *
+ * Finds a free _block of at least 'size' bytes with two bitmap scans.
+ *
+ * \return the _block, still on its list, or NULL if none is big enough
+ */
+static struct _block *findFreeBlock(size_t size)
+{
+    int fl, sl;
+    mappingSearch(size, &fl, &sl);
+    if (fl >= FL_COUNT)
+    {
+        return NULL;
+    }
+
+    unsigned int sl_map = sl_bitmap[fl] & (~0U << sl);
+    if (sl_map == 0)
+    {
+        unsigned int fl_map = (fl + 1 < 32) ? fl_bitmap & (~0U << (fl + 1)) : 0;
+        if (fl_map == 0)
+        {
+            return NULL;
+        }
+        fl = __builtin_ffs(fl_map) - 1;
+        sl_map = sl_bitmap[fl];
+    }
+    sl = __builtin_ffs(sl_map) - 1;
+    return freeLists[fl][sl];
+}
+
+/*
+ * \brief growHeap
+ *
+ * Maps a new pool big enough for 'size' bytes and puts it on the free
+ * lists as one _block, followed by a zero size in use sentinel.
+ *
+ * \return the new free _block or NULL if the OS refused
+ */
+static struct _block *growHeap(size_t size)
+{
+    size_t bytes = size + 2 * HEADER_SIZE;
+    if (bytes < POOL_SIZE)
+    {
+        bytes = POOL_SIZE;
+    }
+    bytes = (bytes + 4095) & ~(size_t)4095;
+
+    struct _block *b = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    b->prev_phys = NULL;
+    b->size = (bytes - 2 * HEADER_SIZE) | BLOCK_FREE;
+
+    struct _block *sentinel = nextPhys(b);
+    sentinel->prev_phys = b;
+    sentinel->size = BLOCK_PREV_FREE;
+
+    insertFree(b);
+
+    num_grows++;
+    num_blocks++;
+    max_heap += bytes;
+    return b;
+}
+
+/*
+ * \brief absorbNext
+ *
+ * Merges the physically next _block, which must be free and already off
+ * its list, into b.
+ */
+static void absorbNext(struct _block *b)
+{
+    struct _block *next = nextPhys(b);
+    b->size += HEADER_SIZE + blockSize(next);
+    nextPhys(b)->prev_phys = b;
+
+    num_coalesces++;
+    num_blocks--;
+}
+
+/*
+ * \brief split
+ *
+ * Trims a _block, which is off the free lists, down to 'size' bytes and
+ * puts the remainder back on them if it is big enough to be a _block.
+ * The remainder is merged with a free next _block so no two free _blocks
+ * are ever adjacent.
+ */
+static void split(struct _block *b, size_t size)
+{
+    size_t total = blockSize(b);
+    if (total < size + sizeof(struct _block))
+    {
+        return;
+    }
+
+    struct _block *rest = (struct _block *)((char *)BLOCK_DATA(b) + size);
+    rest->prev_phys = b;
+    rest->size = (total - size - HEADER_SIZE) | BLOCK_FREE;
+    nextPhys(rest)->prev_phys = rest;
+    nextPhys(rest)->size |= BLOCK_PREV_FREE;
+
+    b->size = size | (b->size & ~SIZE_MASK);
+
+    num_splits++;
+    num_blocks++;
+
+    struct _block *next = nextPhys(rest);
+    if (next->size & BLOCK_FREE)
+    {
+        removeFree(next);
+        absorbNext(rest);
+    }
+    insertFree(rest);
+}
+
+/*
+ * \brief malloc
+ *
+ * Finds a good fit through the bitmaps, grows the heap by a pool if there
+ * is none, and splits off the unused tail.
+ *
+ * \param size size of the requested memory in bytes
+ *
+ * \return returns the requested memory allocation to the calling process
+ * or NULL if failed
+ */
+void *malloc(size_t size)
+{
+    LATENCY_SCOPE(lat_malloc);
+    num_requested += size;
+    registerStatistics();
+
+#if defined HISTOGRAM
+    size_hist[hist_bucket(size)]++;
+#endif
+
+    /* Handle 0 size */
+    if (size == 0)
+    {
+        return NULL;
+    }
+
+    /* past the last size class, and ALIGN8 would wrap near SIZE_MAX */
+    if (size > MAX_SIZE)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    size = ALIGN8(size);
+    if (size < MIN_BLOCK)
+    {
+        size = MIN_BLOCK;
+    }
+
+    struct _block *b;
+    if (size >= LARGE_THRESHOLD)
+    {
+        size_t mapped;
+        b = large_map(size + HEADER_SIZE, &mapped);
+        if (b == NULL)
+        {
+            return NULL;
+        }
+        b->prev_phys = NULL;
+        b->size = (mapped - HEADER_SIZE) | BLOCK_LARGE;
+        num_mallocs++;
+#if defined HISTOGRAM
+        b->birth = num_mallocs;
+        b->birth_ticks = read_ticks();
+#endif
+        return BLOCK_DATA(b);
+    }
+
+    b = findFreeBlock(size);
+    if (b == NULL)
+    {
+        /* the fresh pool may sit one list below the rounded search size, use it directly */
+        b = growHeap(size);
+        if (b == NULL)
+        {
+            return NULL;
+        }
+    }
+    else
+    {
+        num_reuses++;
+    }
+
+    removeFree(b);
+    split(b, size);
+
+    b->size &= ~BLOCK_FREE;
+    nextPhys(b)->size &= ~BLOCK_PREV_FREE;
+    num_mallocs++;
+
+#if defined HISTOGRAM
+    b->birth = num_mallocs;
+    b->birth_ticks = read_ticks();
+#endif
+
+    return BLOCK_DATA(b);
+}
+
+/*
+ * \brief free
+ *
+ * Merges the _block with its free physical neighbours in O(1) and puts the
+ * result on the list for its size.
+ *
+ * \param ptr the heap memory to free
+ *
+ * \return none
+ */
+void free(void *ptr)
+{
+    LATENCY_SCOPE(lat_free);
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    struct _block *b = BLOCK_HEADER(ptr);
+    assert(!(b->size & BLOCK_FREE));
+
+#if defined HISTOGRAM
+    life_hist[hist_bucket(num_mallocs - b->birth)]++;
+    tick_hist[hist_bucket(read_ticks() - b->birth_ticks)]++;
+#endif
+
+    num_frees++;
+
+    if (b->size & BLOCK_LARGE)
+    {
+        large_unmap(b, blockSize(b) + HEADER_SIZE);
+        return;
+    }
+
+    if (b->size & BLOCK_PREV_FREE)
+    {
+        struct _block *prev = b->prev_phys;
+        removeFree(prev);
+        absorbNext(prev);
+        b = prev;
+    }
+
+    struct _block *next = nextPhys(b);
+    if (next->size & BLOCK_FREE)
+    {
+        removeFree(next);
+        absorbNext(b);
+    }
+
+    b->size |= BLOCK_FREE;
+    nextPhys(b)->size |= BLOCK_PREV_FREE;
+    insertFree(b);
+}
+
+/*
+ * \brief calloc
+ *
+ * Allocates zeroed memory for an array of nmemb elements of size bytes each.
+ *
+ * \return returns a pointer to the allocated memory, NULL if failed
+ */
+void *calloc(size_t nmemb, size_t size)
+{
+    if (size && nmemb > (size_t)-1 / size)
+    {
+        return NULL;
+    }
+    void *ptr = malloc(nmemb*size);
+    if (ptr)
+    {
+        memset(ptr, 0, nmemb*size);
+    }
+    return (ptr);
+}
+
+/*
+ * \brief realloc
+ *
+ * Shrinks in place, grows in place into a free next _block when it is big
+ * enough, and otherwise moves the data.
+ *
+ * \return the resized memory, NULL if failed
+ */
+void *realloc(void *ptr, size_t size)
+{
+    LATENCY_SCOPE(lat_realloc);
+    if (ptr == NULL)
+    {
+        return malloc(size);
+    }
+    if (size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+    if (size > MAX_SIZE)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    struct _block *b = BLOCK_HEADER(ptr);
+    size_t want = ALIGN8(size) < MIN_BLOCK ? MIN_BLOCK : ALIGN8(size);
+    if (b->size & BLOCK_LARGE)
+    {
+        if (blockSize(b) >= want)
+        {
+            return ptr;
+        }
+    }
+    else
+    {
+        struct _block *next = nextPhys(b);
+
+        if (blockSize(b) < want && (next->size & BLOCK_FREE) &&
+            blockSize(b) + HEADER_SIZE + blockSize(next) >= want)
+        {
+            removeFree(next);
+            absorbNext(b);
+            nextPhys(b)->size &= ~BLOCK_PREV_FREE;
+        }
+
+        if (blockSize(b) >= want)
+        {
+            split(b, want);
+            return ptr;
+        }
+    }
+
+    void *newptr = malloc(size);
+    if (newptr == NULL)
+    {
+        return NULL;
+    }
+    memcpy(newptr, ptr, blockSize(b));
+    free(ptr);
+    num_realloc_moves++;
+    return newptr;
+}
+
+/*
+ * \brief malloc_usable_size
+ *
+ * \return the bytes that can be used at ptr
+ */
+size_t malloc_usable_size(void *ptr)
+{
+    return ptr ? blockSize(BLOCK_HEADER(ptr)) : 0;
+}
+
+/*
+ * \brief heapFreeSpace
+ *
+ * Sums up the free _blocks for the fragmentation statistics.
+ *
+ * \return none
+ */
+void heapFreeSpace(size_t *free_bytes, size_t *largest_free)
+{
+    int fl, sl;
+    struct _block *b;
+
+    *free_bytes = 0;
+    *largest_free = 0;
+    for (fl = 0; fl < FL_COUNT; fl++)
+    {
+        for (sl = 0; sl < SL_COUNT; sl++)
+        {
+            for (b = freeLists[fl][sl]; b; b = b->next_free)
+            {
+                *free_bytes += blockSize(b);
+                if (blockSize(b) > *largest_free)
+                {
+                    *largest_free = blockSize(b);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "libmalloc.h"
+
+struct node
+{
+  struct node * next;
+  int value;
+};
+
+int main()
+{
+  printf("Running batch test to allocate and free many nodes at once\n");
+
+  struct node * nodes[1000];
+  struct node * head = NULL;
+  int i;
+
+  if( malloc_batch( sizeof( struct node ), 1000, ( void ** ) nodes ) != 1000 )
+  {
+    printf("malloc_batch failed\n");
+    return 1;
+  }
+
+  for( i = 0; i < 1000; i++ )
+  {
+    nodes[i]->value = i;
+    nodes[i]->next = head;
+    head = nodes[i];
+  }
+
+  int sum = 0;
+  struct node * n;
+  for( n = head; n; n = n->next )
+  {
+    sum += n->value;
+  }
+  printf("sum of node values: %d\n", sum );
+
+  free_batch( ( void ** ) nodes, 1000 );
+
+  /* the whole run was coalesced back, so one big block fits in it */
+  char * ptr = ( char * ) malloc( 1000 * sizeof( struct node ) );
+  free( ptr );
+
+  /* a run whose total size wraps must be refused, not under-allocated */
+  if( malloc_batch( SIZE_MAX / 2, 4, ( void ** ) nodes ) != 0 )
+  {
+    printf("malloc_batch accepted a wrapping run\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "libmalloc.h"
+
+#define N 10000
+
+struct inode
+{
+  int    magic;
+  int    refs;
+  char   name[52];
+};
+
+static int constructed = 0;
+static int destructed = 0;
+
+static void inode_ctor( void * p )
+{
+  struct inode * i = ( struct inode * ) p;
+  i->magic = 0x1dea;
+  i->refs = 0;
+  memset( i->name, 0, sizeof( i->name ) );
+  constructed++;
+}
+
+static void inode_dtor( void * p )
+{
+  destructed++;
+}
+
+int main()
+{
+  printf("Running cache test to reuse constructed objects\n");
+
+  struct cache * c = cache_create( "inode", sizeof( struct inode ), 64, inode_ctor, inode_dtor );
+  struct inode * objs[N];
+  int i, round;
+
+  for( round = 0; round < 3; round++ )
+  {
+    for( i = 0; i < N; i++ )
+    {
+      objs[i] = ( struct inode * ) cache_alloc( c );
+      if( ( uintptr_t ) objs[i] % 64 || objs[i]->magic != 0x1dea || objs[i]->refs != 0 )
+      {
+        printf("object %d not constructed or misaligned\n", i);
+        return 1;
+      }
+      objs[i]->refs++;
+    }
+    for( i = 0; i < N; i++ )
+    {
+      /* back to the constructed state before freeing */
+      objs[i]->refs--;
+      cache_free( c, objs[i] );
+    }
+  }
+
+  /* the constructor ran once per object slot, not once per allocation */
+  if( constructed >= 2 * N )
+  {
+    printf("constructor ran %d times\n", constructed);
+    return 1;
+  }
+
+  /* everything is free again, reaping releases every slab */
+  if( cache_reap( c ) == 0 )
+  {
+    printf("nothing reaped\n");
+    return 1;
+  }
+
+  cache_destroy( c );
+  if( destructed != constructed )
+  {
+    printf("constructed %d, destructed %d\n", constructed, destructed);
+    return 1;
+  }
+
+  /* sizes whose slab would overflow and odd alignments are refused */
+  if( cache_create( "huge", SIZE_MAX - 8, 0, NULL, NULL ) != NULL ||
+      cache_create( "huge", SIZE_MAX / 8, 64, NULL, NULL ) != NULL ||
+      cache_create( "odd", 64, 48, NULL, NULL ) != NULL )
+  {
+    printf("cache_create accepted unusable arguments\n");
+    return 1;
+  }
+
+  return 0;
+}
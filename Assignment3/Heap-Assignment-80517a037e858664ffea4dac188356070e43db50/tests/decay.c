@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static long rss_kib( void )
+{
+  long size, resident = 0;
+  FILE * f = fopen( "/proc/self/statm", "r" );
+  if( f )
+  {
+    if( fscanf( f, "%ld %ld", &size, &resident ) != 2 )
+    {
+      resident = 0;
+    }
+    fclose( f );
+  }
+  return resident * ( sysconf( _SC_PAGESIZE ) / 1024 );
+}
+
+static double now( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main( int argc, char * argv[] )
+{
+  /* run with a short decay window so the test does not take 10 s */
+  if( getenv( "LIBMALLOC_DECAY_MS" ) == NULL )
+  {
+    setenv( "LIBMALLOC_DECAY_MS", "200", 1 );
+    execv( "/proc/self/exe", argv );
+  }
+
+  printf("Running decay test to purge idle free pages\n");
+
+  char * ptrs[64];
+  int i;
+
+  for( i = 0; i < 64; i++ )
+  {
+    ptrs[i] = ( char * ) malloc( 64 * 1024 );
+    memset( ptrs[i], i, 64 * 1024 );
+  }
+  for( i = 0; i < 64; i++ )
+  {
+    free( ptrs[i] );
+  }
+  long before = rss_kib();
+
+  /* keep the allocator busy past the window so free() gets to purge */
+  double start = now();
+  while( now() - start < 0.5 )
+  {
+    char * p = ( char * ) malloc( 16 );
+    memset( p, 1, 16 );
+    free( p );
+    usleep( 1000 );
+  }
+
+  /* purged pages must come back usable */
+  char * again = ( char * ) malloc( 1024 * 1024 );
+  memset( again, 7, 1024 * 1024 );
+  for( i = 0; i < 1024 * 1024; i++ )
+  {
+    if( again[i] != 7 )
+    {
+      printf("byte %d lost\n", i);
+      return 1;
+    }
+  }
+  free( again );
+
+  printf("rss after free: %ld KiB, after decay: %ld KiB\n", before, rss_kib());
+  return 0;
+}
@@ -0,0 +1,44 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libmalloc.h"
+
+int main()
+{
+  printf("Running grow test to append one byte at a time\n");
+
+  char * s = NULL;
+  char * t = NULL;
+  int i;
+
+  for( i = 0; i < 100000; i++ )
+  {
+    /* plain realloc, the allocator spots the repeated growth */
+    s = ( char * ) realloc( s, i + 1 );
+    s[i] = 'a' + i % 26;
+
+    /* the explicit variant */
+    t = ( char * ) realloc_grow( t, i + 1, 0 );
+    t[i] = 'a' + i % 26;
+  }
+
+  for( i = 0; i < 100000; i++ )
+  {
+    if( s[i] != 'a' + i % 26 || t[i] != s[i] )
+    {
+      printf("byte %d lost\n", i);
+      return 1;
+    }
+  }
+
+  if( malloc_usable_size( s ) < 100000 || malloc_usable_size( t ) < 100000 )
+  {
+    printf("usable size too small\n");
+    return 1;
+  }
+
+  free( s );
+  free( t );
+  return 0;
+}
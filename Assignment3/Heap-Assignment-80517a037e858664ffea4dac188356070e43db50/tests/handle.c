@@ -0,0 +1,68 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libmalloc.h"
+
+#define N 4000
+
+int main()
+{
+  printf("Running handle test to compact relocatable objects\n");
+
+  struct handle * h[N];
+  int i, j;
+
+  for( i = 0; i < N; i++ )
+  {
+    h[i] = halloc( 100 + i % 300 );
+    memset( hlock( h[i] ), i & 0xff, 100 );
+    hunlock( h[i] );
+  }
+
+  /* pin one object in the middle, it must not move */
+  char * pinned = hlock( h[N / 2] );
+
+  /* punch holes, then keep allocating so the compactor runs */
+  for( i = 0; i < N; i += 2 )
+  {
+    if( i != N / 2 )
+    {
+      hfree( h[i] );
+      h[i] = NULL;
+    }
+  }
+  for( j = 0; j < 20000; j++ )
+  {
+    hfree( halloc( 1000 ) );
+  }
+
+  if( hlock( h[N / 2] ) != pinned )
+  {
+    printf("pinned object moved\n");
+    return 1;
+  }
+  hunlock( h[N / 2] );
+  hunlock( h[N / 2] );
+
+  for( i = 0; i < N; i++ )
+  {
+    if( h[i] == NULL )
+    {
+      continue;
+    }
+    unsigned char * p = hlock( h[i] );
+    for( j = 0; j < 100; j++ )
+    {
+      if( p[j] != ( i & 0xff ) )
+      {
+        printf("object %d corrupted\n", i);
+        return 1;
+      }
+    }
+    hunlock( h[i] );
+    hfree( h[i] );
+  }
+
+  return 0;
+}
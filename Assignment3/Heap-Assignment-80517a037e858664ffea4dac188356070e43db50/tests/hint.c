@@ -0,0 +1,38 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libmalloc.h"
+
+int main()
+{
+  printf("Running hint test to keep short lived objects apart\n");
+
+  char * keep[100];
+  int i, j;
+
+  for( i = 0; i < 100; i++ )
+  {
+    /* a long lived object every round ... */
+    keep[i] = ( char * ) malloc_hint( 100, HINT_LONG );
+
+    /* ... among lots of short lived ones that die together */
+    char * tmp[200];
+    for( j = 0; j < 200; j++ )
+    {
+      tmp[j] = ( char * ) malloc_hint( 64 + j, HINT_SHORT );
+      memset( tmp[j], j, 64 );
+    }
+    for( j = 0; j < 200; j++ )
+    {
+      free( tmp[j] );
+    }
+  }
+
+  for( i = 0; i < 100; i++ )
+  {
+    free( keep[i] );
+  }
+
+  return 0;
+}
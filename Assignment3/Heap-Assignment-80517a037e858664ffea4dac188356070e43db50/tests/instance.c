@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "libmalloc.h"
+
+struct entry
+{
+  size_t next;     /* offset of the next entry, 0 ends the list */
+  char   name[32];
+};
+
+int main()
+{
+  printf("Running instance test to share a heap between processes\n");
+
+  size_t size = 1024 * 1024;
+  void * shared = mmap( NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+
+  struct instance * h = instance_create( shared, size );
+
+  pid_t pid = fork();
+  if( pid == 0 )
+  {
+    /* the child builds a list inside the shared region */
+    struct instance * ch = instance_attach( shared );
+    size_t head = 0;
+    int i;
+    for( i = 0; i < 3; i++ )
+    {
+      struct entry * e = ( struct entry * ) instance_alloc( ch, sizeof( struct entry ) );
+      snprintf( e->name, sizeof( e->name ), "child entry %d", i );
+      e->next = head;
+      head = instance_offset( ch, e );
+    }
+    instance_set_root( ch, instance_pointer( ch, head ) );
+    _exit( 0 );
+  }
+  waitpid( pid, NULL, 0 );
+
+  /* the parent walks it through the offsets and frees it */
+  struct entry * e = ( struct entry * ) instance_root( h );
+  while( e )
+  {
+    struct entry * next = ( struct entry * ) instance_pointer( h, e->next );
+    printf("%s\n", e->name );
+    instance_free( h, e );
+    e = next;
+  }
+
+  /* everything coalesced back into one block */
+  void * all = instance_alloc( h, size - 4096 );
+  printf("whole region free again: %s\n", all ? "yes" : "no" );
+
+  munmap( shared, size );
+  return 0;
+}
@@ -0,0 +1,42 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+int main()
+{
+  printf("Running large test to reuse cached large mappings\n");
+
+  int i;
+  for ( i = 0; i < 100; i++ )
+  {
+    /* scanline sized buffers that vary a little in size */
+    char * ptr = ( char * ) malloc ( 4 * 1024 * 1024 + ( i % 4 ) * 4096 );
+    memset( ptr, i, 4096 );
+    free( ptr );
+  }
+
+  /* one that grows past the threshold through realloc */
+  char * buf = NULL;
+  for ( i = 1; i <= 64; i++ )
+  {
+    buf = ( char * ) realloc( buf, i * 16 * 1024 );
+    buf[ i * 16 * 1024 - 1 ] = 'x';
+  }
+  free( buf );
+
+  /* sizes that wrap once the header and page rounding are added */
+  size_t huge[] = { SIZE_MAX, SIZE_MAX - 5, SIZE_MAX - 20, SIZE_MAX - 4096 };
+  buf = ( char * ) malloc( 100 );
+  for ( i = 0; i < 4; i++ )
+  {
+    if ( malloc( huge[i] ) != NULL || realloc( buf, huge[i] ) != NULL )
+    {
+      printf("huge request %zx was not refused\n", huge[i] );
+      return 1;
+    }
+  }
+  free( buf );
+
+  return 0;
+}
@@ -0,0 +1,46 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "libmalloc.h"
+
+int main()
+{
+  printf("Running region test to bump allocate and bulk reset\n");
+
+  struct region *r = region_create( 4096 );
+
+  char * line = "ls -l /tmp ; echo hello";
+  char * tokens[64];
+  int i;
+
+  for( i = 0; i < 64; i++ )
+  {
+    tokens[i] = region_strndup( r, line + ( i % 8 ), 4 );
+  }
+
+  printf("token 0: %s token 63: %s\n", tokens[0], tokens[63] );
+
+  /* larger than a chunk, gets a chunk of its own */
+  char * big = ( char * ) region_alloc( r, 10000 );
+  memset( big, 'x', 10000 );
+
+  char * first = tokens[0];
+
+  /* sizes that wrap once aligned or given a chunk header are refused */
+  if( region_alloc( r, SIZE_MAX - 40 ) != NULL || region_alloc( r, SIZE_MAX ) != NULL )
+  {
+    printf("region_alloc accepted a wrapping size\n");
+    return 1;
+  }
+
+  region_reset( r );
+
+  char * again = region_strdup( r, "reused" );
+  printf("first chunk reused after reset: %s\n", again == first ? "yes" : "no" );
+
+  region_destroy( r );
+
+  return 0;
+}
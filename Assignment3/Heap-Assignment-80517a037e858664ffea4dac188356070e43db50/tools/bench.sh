@@ -0,0 +1,100 @@
+#!/bin/bash
+#
+# Real workload benchmark.  Runs scripted sessions of the shell (msh), the
+# file system shell (mfs) and the fractal generator (mandel, one thread) from
+# the other assignments with every lib/libmalloc-*.so preloaded and with
+# plain glibc, then tabulates wall time, peak RSS and the allocator's own
+# statistics.  Full output of every run, statistics dump included, is kept
+# in the results directory.
+#
+# usage: tools/bench.sh [results dir]     (after make, from this directory)
+#
+# ROUNDS scales the msh and mfs sessions, default 20.  TOP is the top of
+# the repository, found from this directory by default.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")/.." && pwd)
+TOP=${TOP:-$(cd "$HERE/../.." && pwd)}
+OUT=${1:-$HERE/bench-results}
+ROUNDS=${ROUNDS:-20}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$OUT"
+cd "$HERE"
+make -s lib/libmalloc-ff.so tools/runstat >/dev/null
+for lib in lib/libmalloc-*.so; do
+	[ -f "$lib" ] || { echo "bench: run make first" >&2; exit 1; }
+done
+
+# the programs are built as they are, warnings and all
+gcc -g -std=gnu99 -w -o "$WORK/msh" "$TOP/Assignment1/msh.c"
+gcc -g -std=gnu99 -w -o "$WORK/mfs" "$TOP/Assignment4/mfs.c"
+# mandel is every source at the top of its directory
+gcc -g -std=gnu99 -w -I"$TOP/Assignment3/Heap-Assignment-master" -o "$WORK/mandel" \
+	"$TOP"/Assignment3/Heap-Assignment-master/*.c -lpthread -lm
+
+# msh: builtins and history churn strdup/strndup, now and then a real command
+for ((i = 0; i < ROUNDS * 100; i++)); do
+	echo "cd . ; history ; cd $WORK ; listpids"
+	[ $((i % 50)) -eq 0 ] && echo "echo alpha beta gamma delta epsilon zeta eta theta"
+done > "$WORK/msh.in"
+echo "exit" >> "$WORK/msh.in"
+
+# mfs: put/get/del files of a few sizes through an image
+head -c 4000 /dev/urandom > "$WORK/f1"
+head -c 40000 /dev/urandom > "$WORK/f2"
+head -c 200000 /dev/urandom > "$WORK/f3"
+head -c 1000000 /dev/urandom > "$WORK/f4"
+{
+	echo "createfs disk.img"
+	echo "open disk.img"
+	for ((i = 0; i < ROUNDS; i++)); do
+		for f in f1 f2 f3 f4; do
+			echo "put $f"
+			echo "list"
+			echo "get $f out.$f"
+			echo "df"
+		done
+		for f in f1 f2 f3 f4; do
+			echo "del $f"
+		done
+	done
+	echo "close"
+	echo "quit"
+} > "$WORK/mfs.in"
+
+run()
+{
+	local name=$1 alloc=$2 input=$3 log="$OUT/$1-$2.log"
+	shift 3
+	local preload=()
+	[ "$alloc" != glibc ] && preload=(-p "$HERE/lib/libmalloc-$alloc.so")
+
+	# every run starts from a fresh image
+	rm -f "$WORK"/disk.img "$WORK"/out.*
+
+	local rc=0
+	(cd "$WORK" && "$HERE/tools/runstat" "${preload[@]}" "$@" < "$input") > "$log" 2>&1 || rc=$?
+
+	local stat=$(grep -o 'runstat: wall=.*' "$log" | tail -1)
+	local wall=$(echo "$stat" | sed -n 's/.*wall=\([0-9.]*\).*/\1/p')
+	local rss=$(echo "$stat" | sed -n 's/.*maxrss=\([0-9]*\).*/\1/p')
+	# the last dump is the program's own, the commands msh runs exit first
+	local mallocs=$(grep '^mallocs:' "$log" | tail -1 | awk '{print $2}')
+	local heap=$(grep '^max heap:' "$log" | tail -1 | awk '{print $3}')
+	local frag=$(grep '^fragmentation:' "$log" | tail -1 | awk '{print $2}')
+	printf "%-8s %-8s %8s %10s %10s %12s %6s %4s\n" "$name" "$alloc" \
+		"${wall:--}" "${rss:--}" "${mallocs:--}" "${heap:--}" "${frag:--}" "$rc"
+}
+
+printf "%-8s %-8s %8s %10s %10s %12s %6s %4s\n" \
+	program alloc "wall(s)" "rss(KiB)" mallocs "max heap" frag rc
+for alloc in glibc $(ls lib/libmalloc-*.so | sed 's/.*libmalloc-\(.*\)\.so/\1/'); do
+	run msh    "$alloc" "$WORK/msh.in" ./msh
+	run mfs    "$alloc" "$WORK/mfs.in" ./mfs
+	# none of the libmalloc builds lock, so mandel's workers would race in
+	# them; every allocator gets the single threaded run to stay comparable
+	run mandel "$alloc" /dev/null ./mandel -W 800 -H 800 -m 500 -n 1 -o mandel.bmp
+done | tee "$OUT/summary.txt"
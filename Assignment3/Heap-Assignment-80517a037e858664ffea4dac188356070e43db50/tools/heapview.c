@@ -0,0 +1,261 @@
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitmap.h"
+#include "libmalloc.h"
+
+/*
+ * Heap layout visualizer.  Replays an allocation trace and every few
+ * operations walks the heap with heap_walk(), drawing one pixel per N bytes
+ * of address space, row by row from the top left:
+ *
+ *    red     _block headers
+ *    blue    bytes the program asked for
+ *    yellow  slack, bytes handed out beyond the request
+ *    green   free _blocks
+ *
+ * Run it with each build preloaded to compare how the policies fragment
+ * the same trace:
+ *
+ *    LD_PRELOAD=lib/libmalloc-bf.so tools/heapview -o frames/bf
+ *
+ * A trace has one operation per line, ids index a table of live objects:
+ *
+ *    m <id> <size>     malloc
+ *    r <id> <size>     realloc
+ *    f <id>            free
+ */
+
+#define MAX_IDS         65536
+#define HASH_SIZE       (2 * MAX_IDS)
+
+#define COLOUR_HEADER   MAKE_RGBA(200, 40, 40, 0)
+#define COLOUR_USED     MAKE_RGBA(0, 90, 200, 0)
+#define COLOUR_SLACK    MAKE_RGBA(230, 200, 0, 0)
+#define COLOUR_FREE     MAKE_RGBA(40, 200, 70, 0)
+
+static void  *objects[MAX_IDS];     /* live object of each id            */
+static size_t requested[MAX_IDS];   /* bytes asked for by the trace      */
+
+/* pointer -> requested size, rebuilt for every frame */
+static void  *hash_keys[HASH_SIZE];
+static size_t hash_vals[HASH_SIZE];
+
+struct frame
+{
+    struct bitmap *bm;
+    char   *base;                   /* address drawn at the top left     */
+    size_t  bytes_per_pixel;
+};
+
+void show_help()
+{
+	printf("Use: heapview [options]\n");
+	printf("Where options are:\n");
+	printf("-t <file>    Trace to replay. (default=built in random workload)\n");
+	printf("-o <prefix>  Frames are written to <prefix>-0000.bmp and up. (default=heap)\n");
+	printf("-n <bytes>   Bytes of address space per pixel. (default=64)\n");
+	printf("-e <ops>     Operations between frames. (default=1000)\n");
+	printf("-W <pixels>  Width of the frames in pixels. (default=512)\n");
+	printf("-H <pixels>  Height of the frames in pixels. (default=512)\n");
+	printf("-h           Show this help text.\n");
+}
+
+static size_t hash_slot( void *ptr )
+{
+	return ((uintptr_t)ptr >> 4) * 2654435761u % HASH_SIZE;
+}
+
+static void hash_build( void )
+{
+	size_t i, h;
+	memset(hash_keys, 0, sizeof(hash_keys));
+	for(i=0;i<MAX_IDS;i++) {
+		if(!objects[i]) continue;
+		for(h=hash_slot(objects[i]); hash_keys[h]; h=(h+1)%HASH_SIZE);
+		hash_keys[h] = objects[i];
+		hash_vals[h] = requested[i];
+	}
+}
+
+/* requested size of ptr, or (size_t)-1 if the trace did not allocate it */
+static size_t hash_find( void *ptr )
+{
+	size_t h;
+	for(h=hash_slot(ptr); hash_keys[h]; h=(h+1)%HASH_SIZE) {
+		if(hash_keys[h]==ptr) return hash_vals[h];
+	}
+	return (size_t)-1;
+}
+
+/* colours the pixels covering [from, to) bytes past the frame base */
+static void paint( struct frame *f, size_t from, size_t to, int colour )
+{
+	int w = bitmap_width(f->bm);
+	int h = bitmap_height(f->bm);
+	size_t p;
+
+	if(to<=from) return;
+	for(p=from/f->bytes_per_pixel; p<=(to-1)/f->bytes_per_pixel; p++) {
+		size_t y = p / w;
+		if(y>=(size_t)h) return;
+		bitmap_set(f->bm, p % w, h - 1 - y, colour);
+	}
+}
+
+static void draw_block( void *block, size_t header, size_t size, int used, void *arg )
+{
+	struct frame *f = arg;
+	if(!f->base) f->base = block;
+	if((char *)block < f->base) return;
+
+	size_t start = (char *)block - f->base;
+	paint(f, start, start + header, COLOUR_HEADER);
+	start += header;
+
+	if(!used) {
+		paint(f, start, start + size, COLOUR_FREE);
+		return;
+	}
+
+	size_t want = hash_find((char *)block + header);
+	if(want>size) want = size;
+	paint(f, start, start + want, COLOUR_USED);
+	paint(f, start + want, start + size, COLOUR_SLACK);
+}
+
+static void save_frame( struct frame *f, const char *prefix, int n )
+{
+	char name[1024];
+
+	bitmap_reset(f->bm, MAKE_RGBA(0, 0, 0, 0));
+	hash_build();
+	heap_walk(draw_block, f);
+
+	snprintf(name, sizeof(name), "%s-%04d.bmp", prefix, n);
+	if(!bitmap_save(f->bm, name)) {
+		fprintf(stderr, "heapview: couldn't write to %s\n", name);
+		exit(1);
+	}
+}
+
+/* one operation of the trace, returns 0 at the end */
+static int next_op( FILE *trace, char *op, int *id, size_t *size )
+{
+	static unsigned long seed = 12345;
+	static int count = 0;
+
+	if(trace) {
+		char line[128];
+		while(fgets(line, sizeof(line), trace)) {
+			*size = 0;
+			if(sscanf(line, " %c %d %zu", op, id, size) >= 2 && *id >= 0 && *id < MAX_IDS) return 1;
+		}
+		return 0;
+	}
+
+	/* built in workload: mostly small objects, now and then a big one */
+	if(count++ == 50000) return 0;
+	seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+	*id = (seed >> 33) % 2048;
+	if(objects[*id]) {
+		*op = ((seed >> 20) & 3) ? 'f' : 'r';
+	} else {
+		*op = 'm';
+	}
+	*size = ((seed >> 40) & 15) ? 16 + (seed >> 44) % 512 : 4096 + (seed >> 44) % 32768;
+	return 1;
+}
+
+int main( int argc, char *argv[] )
+{
+	int c;
+	const char *tracefile = NULL;
+	const char *prefix = "heap";
+	size_t bytes_per_pixel = 64;
+	int every = 1000;
+	int width = 512;
+	int height = 512;
+
+	while((c = getopt(argc,argv,"t:o:n:e:W:H:h"))!=-1) {
+		switch(c) {
+			case 't':
+				tracefile = optarg;
+				break;
+			case 'o':
+				prefix = optarg;
+				break;
+			case 'n':
+				bytes_per_pixel = strtoul(optarg, NULL, 0);
+				break;
+			case 'e':
+				every = atoi(optarg);
+				break;
+			case 'W':
+				width = atoi(optarg);
+				break;
+			case 'H':
+				height = atoi(optarg);
+				break;
+			case 'h':
+				show_help();
+				exit(1);
+				break;
+		}
+	}
+	if(bytes_per_pixel == 0 || every <= 0 || width <= 0 || height <= 0) {
+		show_help();
+		exit(1);
+	}
+
+	FILE *trace = NULL;
+	if(tracefile) {
+		trace = fopen(tracefile, "r");
+		if(!trace) {
+			fprintf(stderr, "heapview: couldn't open %s\n", tracefile);
+			return 1;
+		}
+	}
+
+	struct frame f = { bitmap_create(width, height), NULL, bytes_per_pixel };
+	if(!f.bm) {
+		fprintf(stderr, "heapview: out of memory\n");
+		return 1;
+	}
+
+	char op;
+	int id, ops = 0, frames = 0;
+	size_t size;
+	while(next_op(trace, &op, &id, &size)) {
+		switch(op) {
+			case 'm':
+				free(objects[id]);
+				objects[id] = malloc(size);
+				requested[id] = objects[id] ? size : 0;
+				break;
+			case 'r': {
+				void *p = realloc(objects[id], size);
+				if(p || size == 0) {
+					objects[id] = p;
+					requested[id] = size;
+				}
+				break;
+			}
+			case 'f':
+				free(objects[id]);
+				objects[id] = NULL;
+				break;
+		}
+		if(++ops % every == 0) save_frame(&f, prefix, frames++);
+	}
+	save_frame(&f, prefix, frames++);
+
+	printf("heapview: %d operations, %d frames written to %s-*.bmp\n", ops, frames, prefix);
+
+	if(trace) fclose(trace);
+	bitmap_delete(f.bm);
+	return 0;
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Runs a command, optionally with an allocator preloaded, and reports its
+ * wall time and peak RSS on stderr once it exits:
+ *
+ *    runstat [-p lib/libmalloc-ff.so] command [args...]
+ *    runstat: wall=1.234 maxrss=5678
+ *
+ * Only the command gets LD_PRELOAD, runstat itself runs on glibc.  maxrss
+ * is in KiB and covers the command's children as well.
+ */
+
+int main( int argc, char *argv[] )
+{
+	const char *preload = NULL;
+	int first = 1;
+
+	if(argc > 2 && strcmp(argv[1], "-p") == 0) {
+		preload = argv[2];
+		first = 3;
+	}
+	if(first >= argc) {
+		fprintf(stderr, "Use: runstat [-p <library>] command [args...]\n");
+		return 1;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pid_t pid = fork();
+	if(pid < 0) {
+		perror("runstat: fork");
+		return 1;
+	}
+	if(pid == 0) {
+		if(preload) setenv("LD_PRELOAD", preload, 1);
+		execvp(argv[first], &argv[first]);
+		perror("runstat: exec");
+		_exit(127);
+	}
+
+	int status;
+	struct rusage usage;
+	if(wait4(pid, &status, 0, &usage) < 0) {
+		perror("runstat: wait");
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	struct rusage children;
+	getrusage(RUSAGE_CHILDREN, &children);
+
+	double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	long maxrss = usage.ru_maxrss > children.ru_maxrss ? usage.ru_maxrss : children.ru_maxrss;
+	fprintf(stderr, "runstat: wall=%.3f maxrss=%ld\n", wall, maxrss);
+
+	if(WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+	return WEXITSTATUS(status);
+}
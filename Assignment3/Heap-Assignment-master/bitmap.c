@@ -99,55 +99,106 @@ struct bmp_header {
 	int	icolors;
 };
 
-int bitmap_save( struct bitmap *m, const char *path )
-{
+struct bitmap_writer {
 	FILE *file;
+	int width;
+	int padlength;
+	unsigned char *scanline;
+};
+
+/*
+Start a BMP file of w by h pixels, for scanlines to be added a band at
+a time.  BMP keeps its rows bottom up, so row 0 goes first.
+*/
+
+struct bitmap_writer * bitmap_writer_open( const char *path, int w, int h )
+{
+	struct bitmap_writer *bw;
 	struct bmp_header header;
-	int i, j;
-	unsigned char *scanline, *s;
 
-	file = fopen(path,"wb");
-	if(!file) return 0;
+	bw = malloc(sizeof *bw);
+	if(!bw) return 0;
+
+	bw->scanline = malloc(w*3);
+	if(!bw->scanline) {
+		free(bw);
+		return 0;
+	}
+
+	bw->file = fopen(path,"wb");
+	if(!bw->file) {
+		free(bw->scanline);
+		free(bw);
+		return 0;
+	}
 
+	/* the sizes wrap past 4GB, where BMP runs out of bits */
 	memset(&header,0,sizeof(header));
 	header.magic1 = 'B';
 	header.magic2 = 'M';
-	header.size   = m->width*m->height*3;
+	header.size   = (long long)w*h*3;
 	header.offset = sizeof(header);
 	header.infosize = sizeof(header)-14;
-	header.width = m->width;
-	header.height = m->height;
+	header.width = w;
+	header.height = h;
 	header.planes = 1;
 	header.bits = 24;
 	header.compression = 0;
-	header.imagesize = m->width*m->height*3;
+	header.imagesize = (long long)w*h*3;
 	header.xres = 1000;
 	header.yres = 1000;
 
-	fwrite(&header,1,sizeof(header),file);
+	fwrite(&header,1,sizeof(header),bw->file);
 
 	/* if the scanline is not a multiple of four, round it up. */
-	int padlength = 4 - (m->width*3)%4;
-	if(padlength==4) padlength=0;
+	bw->padlength = 4 - (w*3)%4;
+	if(bw->padlength==4) bw->padlength=0;
+	bw->width = w;
 
-	scanline = malloc(header.width*3);
+	return bw;
+}
+
+/* Add the first rows of m as the next scanlines. */
+int bitmap_writer_rows( struct bitmap_writer *bw, struct bitmap *m, int rows )
+{
+	int i, j;
+	unsigned char *s;
 
-	for(j=0;j<m->height;j++) {
-		s = scanline;
-		for(i=0;i<m->width;i++) {
+	for(j=0;j<rows;j++) {
+		s = bw->scanline;
+		for(i=0;i<bw->width;i++) {
 			int rgba = bitmap_get(m,i,j);
 			*s++ = GET_BLUE(rgba);
 			*s++ = GET_GREEN(rgba);
 			*s++ = GET_RED(rgba);
 		}
-		fwrite(scanline,1,m->width*3,file);
-		fwrite(scanline,1,padlength,file);
+		fwrite(bw->scanline,1,bw->width*3,bw->file);
+		fwrite(bw->scanline,1,bw->padlength,bw->file);
 	}
 
-	free(scanline);
+	return !ferror(bw->file);
+}
 
-	fclose(file);
-	return 1;
+int bitmap_writer_close( struct bitmap_writer *bw )
+{
+	int ok = !ferror(bw->file);
+
+	if(fclose(bw->file)) ok = 0;
+	free(bw->scanline);
+	free(bw);
+
+	return ok;
+}
+
+int bitmap_save( struct bitmap *m, const char *path )
+{
+	struct bitmap_writer *bw;
+
+	bw = bitmap_writer_open(path,m->width,m->height);
+	if(!bw) return 0;
+
+	bitmap_writer_rows(bw,m,m->height);
+	return bitmap_writer_close(bw);
 }
 
 struct bitmap * bitmap( const char *path )
@@ -14,6 +14,10 @@ int   bitmap_height( struct bitmap *b );
 void  bitmap_reset( struct bitmap *b, int value );
 int  *bitmap_data( struct bitmap *b );
 
+struct bitmap_writer * bitmap_writer_open( const char *file, int w, int h );
+int                    bitmap_writer_rows( struct bitmap_writer *w, struct bitmap *b, int rows );
+int                    bitmap_writer_close( struct bitmap_writer *w );
+
 #ifndef MAKE_RGBA
 /** Create a 32-bit RGBA value from 8-bit red, green, blue, and alpha values */
 #define MAKE_RGBA(r,g,b,a) ( (((int)(a))<<24) | (((int)(r))<<16) | (((int)(g))<<8) | (((int)(b))<<0) )
@@ -0,0 +1,148 @@
+#ifndef DD_H
+#define DD_H
+
+#include <stdlib.h>
+
+/*
+Double-double arithmetic: a number is the unevaluated sum hi+lo of two
+doubles with |lo| <= ulp(hi)/2, about 106 bits of mantissa.  The error
+free transformations below need every operation rounded on its own, so
+nothing here may be fused into an FMA behind our back: where the CPU
+has FMA we use it explicitly, elsewhere products are split by hand.
+*/
+
+struct dd {
+	double hi;
+	double lo;
+};
+
+static inline struct dd dd_make( double hi, double lo )
+{
+	struct dd r = { hi, lo };
+	return r;
+}
+
+/* s+e == a+b exactly */
+static inline struct dd dd_two_sum( double a, double b )
+{
+	double s = a + b;
+	double bb = s - a;
+	double e = (a - (s - bb)) + (b - bb);
+	return dd_make(s,e);
+}
+
+/* s+e == a+b exactly, given |a| >= |b| */
+static inline struct dd dd_quick_two_sum( double a, double b )
+{
+	double s = a + b;
+	double e = b - (s - a);
+	return dd_make(s,e);
+}
+
+/* p+e == a*b exactly */
+static inline struct dd dd_two_prod( double a, double b )
+{
+	double p = a * b;
+#if defined __FMA__
+	double e = __builtin_fma(a,b,-p);
+#else
+	const double split = 134217729.0;	// 2^27+1
+	double t = split * a;
+	double ah = t - (t - a), al = a - ah;
+	t = split * b;
+	double bh = t - (t - b), bl = b - bh;
+	double e = ((ah*bh - p) + ah*bl + al*bh) + al*bl;
+#endif
+	return dd_make(p,e);
+}
+
+static inline struct dd dd_add( struct dd a, struct dd b )
+{
+	struct dd s = dd_two_sum(a.hi,b.hi);
+	struct dd t = dd_two_sum(a.lo,b.lo);
+	s.lo += t.hi;
+	s = dd_quick_two_sum(s.hi,s.lo);
+	s.lo += t.lo;
+	return dd_quick_two_sum(s.hi,s.lo);
+}
+
+static inline struct dd dd_add_d( struct dd a, double b )
+{
+	struct dd s = dd_two_sum(a.hi,b);
+	s.lo += a.lo;
+	return dd_quick_two_sum(s.hi,s.lo);
+}
+
+static inline struct dd dd_neg( struct dd a )
+{
+	return dd_make(-a.hi,-a.lo);
+}
+
+static inline struct dd dd_sub( struct dd a, struct dd b )
+{
+	return dd_add(a,dd_neg(b));
+}
+
+static inline struct dd dd_mul( struct dd a, struct dd b )
+{
+	struct dd p = dd_two_prod(a.hi,b.hi);
+	p.lo += a.hi*b.lo + a.lo*b.hi;
+	return dd_quick_two_sum(p.hi,p.lo);
+}
+
+static inline struct dd dd_mul_d( struct dd a, double b )
+{
+	struct dd p = dd_two_prod(a.hi,b);
+	p.lo += a.lo*b;
+	return dd_quick_two_sum(p.hi,p.lo);
+}
+
+static inline struct dd dd_sqr( struct dd a )
+{
+	struct dd p = dd_two_prod(a.hi,a.hi);
+	p.lo += 2*a.hi*a.lo;
+	return dd_quick_two_sum(p.hi,p.lo);
+}
+
+static inline struct dd dd_div_d( struct dd a, double b )
+{
+	double q1 = a.hi / b;
+	struct dd r = dd_sub(a,dd_two_prod(q1,b));
+	double q2 = r.hi / b;
+	r = dd_sub(r,dd_two_prod(q2,b));
+	double q3 = r.hi / b;
+	return dd_add_d(dd_quick_two_sum(q1,q2),q3);
+}
+
+/*
+Parse a decimal number like strtod() does, but to double-double
+precision, so a center point typed with 30 digits keeps them.
+*/
+
+static inline struct dd dd_parse( const char *s )
+{
+	struct dd r = dd_make(0,0);
+	int neg = 0, exp = 0, dot = 0;
+
+	while(*s==' ' || *s=='\t') s++;
+	if(*s=='-' || *s=='+') neg = *s++ == '-';
+
+	for(;;s++) {
+		if(*s>='0' && *s<='9') {
+			r = dd_add_d(dd_mul_d(r,10),*s-'0');
+			if(dot) exp--;
+		} else if(*s=='.' && !dot) {
+			dot = 1;
+		} else {
+			break;
+		}
+	}
+	if(*s=='e' || *s=='E') exp += atoi(s+1);
+
+	for(;exp>0;exp--) r = dd_mul_d(r,10);
+	for(;exp<0;exp++) r = dd_div_d(r,10);
+
+	return neg ? dd_neg(r) : r;
+}
+
+#endif
@@ -0,0 +1,743 @@
+#include <immintrin.h>
+#include <math.h>
+#include <string.h>
+
+#include "dd.h"
+#include "kernel.h"
+
+/*
+The vector kernels run every lane until all of them have escaped or hit
+max.  A lane that escaped keeps iterating with its mask off so its count
+stops, the way the scalar loop stops.  Products and sums are the same
+operations in the same order as the scalar loop, and nothing is fused,
+so each lane rounds exactly like iterations_at_point().
+*/
+
+#define MAX_LANES 16
+
+/*
+Pixel spacing below which a precision runs out.  Each leaves some ten
+bits for the rounding error the iterations pile up: float resolves
+about 2e-7 near the set, double 4e-16 and double-double 1e-31.
+Float has so few bits that its error also grows visibly with the
+number of iterations, so it is only used while spacing*max stays
+above FLOAT_MIN_REACH as well: coarse views with short orbits.
+*/
+
+#define FLOAT_MIN_SPACING  1e-4
+#define FLOAT_MIN_REACH    10
+#define DOUBLE_MIN_SPACING 1e-12
+#define DD_MIN_SPACING     1e-28
+
+/*
+Early outs for points in the set, which would otherwise run to max.
+A point in the main cardioid or the period 2 bulb is known without
+iterating; BULB_MARGIN keeps the ones whose test is too close to call
+iterating as before.  An orbit that comes back within PERIOD_EPS of
+where it was at the last power of two iteration (Brent) has settled
+on a cycle and never escapes.
+*/
+
+#define BULB_MARGIN        1e-12
+#define PERIOD_EPS_FLOAT   1e-6f
+#define PERIOD_EPS_DOUBLE  1e-13
+#define PERIOD_EPS_DD      1e-30
+
+static int early_outs = EARLY_BULB | EARLY_PERIOD;
+
+static long      bulb_pixels = 0;
+static long      periodic_pixels = 0;
+static long long saved_iterations = 0;
+
+/* Count the pixels of a span that a cycle stopped, and what that saved. */
+static void note_periodic( long pixels, long long saved )
+{
+	if(!pixels) return;
+	__atomic_fetch_add(&periodic_pixels,pixels,__ATOMIC_RELAXED);
+	__atomic_fetch_add(&saved_iterations,saved,__ATOMIC_RELAXED);
+}
+
+/*
+Return the number of iterations at point x, y
+in the Mandelbrot space, up to a maximum of max.
+With period set, stop at max as soon as the orbit cycles,
+counting the iterations that saved in *saved.
+*/
+
+static int iterations_at_point( double x, double y, int max, int period, long long *saved )
+{
+	double x0 = x;
+	double y0 = y;
+	double sx = x, sy = y;
+
+	int iter = 0;
+
+	while( (x*x + y*y <= 4) && iter < max ) {
+
+		double xt = x*x - y*y + x0;
+		double yt = 2*x*y + y0;
+
+		x = xt;
+		y = yt;
+
+		iter++;
+
+		if(period) {
+			if(fabs(x-sx) < PERIOD_EPS_DOUBLE && fabs(y-sy) < PERIOD_EPS_DOUBLE) {
+				*saved += max - iter;
+				return -1;
+			}
+			if(!(iter & (iter-1))) {
+				sx = x;
+				sy = y;
+			}
+		}
+	}
+
+	return iter;
+}
+
+static void span_scalar( const double *x, const double *xlo, const double *y, const double *ylo, int n, int max, int *iters )
+{
+	int period = early_outs & EARLY_PERIOD;
+	long long saved = 0;
+	long cycles = 0;
+	int i;
+
+	for(i=0;i<n;i++) {
+		iters[i] = iterations_at_point(x[i],y[i],max,period,&saved);
+		if(iters[i]<0) {
+			iters[i] = max;
+			cycles++;
+		}
+	}
+	note_periodic(cycles,saved);
+}
+
+static int iterations_at_point_f( float x, float y, int max, int period, long long *saved )
+{
+	float x0 = x;
+	float y0 = y;
+	float sx = x, sy = y;
+
+	int iter = 0;
+
+	while( (x*x + y*y <= 4) && iter < max ) {
+
+		float xt = x*x - y*y + x0;
+		float yt = 2*x*y + y0;
+
+		x = xt;
+		y = yt;
+
+		iter++;
+
+		if(period) {
+			if(fabsf(x-sx) < PERIOD_EPS_FLOAT && fabsf(y-sy) < PERIOD_EPS_FLOAT) {
+				*saved += max - iter;
+				return -1;
+			}
+			if(!(iter & (iter-1))) {
+				sx = x;
+				sy = y;
+			}
+		}
+	}
+
+	return iter;
+}
+
+static void span_scalar_f( const double *x, const double *xlo, const double *y, const double *ylo, int n, int max, int *iters )
+{
+	int period = early_outs & EARLY_PERIOD;
+	long long saved = 0;
+	long cycles = 0;
+	int i;
+
+	for(i=0;i<n;i++) {
+		iters[i] = iterations_at_point_f(x[i],y[i],max,period,&saved);
+		if(iters[i]<0) {
+			iters[i] = max;
+			cycles++;
+		}
+	}
+	note_periodic(cycles,saved);
+}
+
+static int iterations_at_point_dd( struct dd x, struct dd y, int max, int period, long long *saved )
+{
+	struct dd x0 = x;
+	struct dd y0 = y;
+	struct dd sx = x, sy = y;
+
+	int iter = 0;
+
+	while( iter < max ) {
+
+		struct dd xx = dd_sqr(x);
+		struct dd yy = dd_sqr(y);
+		if( xx.hi + yy.hi > 4 ) break;
+
+		struct dd xt = dd_add(dd_sub(xx,yy),x0);
+		y = dd_add(dd_mul_d(dd_mul(x,y),2),y0);
+		x = xt;
+
+		iter++;
+
+		if(period) {
+			if(fabs(dd_sub(x,sx).hi) < PERIOD_EPS_DD && fabs(dd_sub(y,sy).hi) < PERIOD_EPS_DD) {
+				*saved += max - iter;
+				return -1;
+			}
+			if(!(iter & (iter-1))) {
+				sx = x;
+				sy = y;
+			}
+		}
+	}
+
+	return iter;
+}
+
+static void span_scalar_dd( const double *x, const double *xlo, const double *y, const double *ylo, int n, int max, int *iters )
+{
+	int period = early_outs & EARLY_PERIOD;
+	long long saved = 0;
+	long cycles = 0;
+	int i;
+
+	for(i=0;i<n;i++) {
+		iters[i] = iterations_at_point_dd(dd_make(x[i],xlo[i]),dd_make(y[i],ylo[i]),max,period,&saved);
+		if(iters[i]<0) {
+			iters[i] = max;
+			cycles++;
+		}
+	}
+	note_periodic(cycles,saved);
+}
+
+/* The last lanes of a short run repeat its last pixel. */
+static const double * pad( const double *x, int n, int lanes, double *buf )
+{
+	int i;
+	if(n>=lanes) return x;
+	for(i=0;i<lanes;i++) {
+		buf[i] = x[i<n ? i : n-1];
+	}
+	return buf;
+}
+
+/* The lanes that hold pixels of the run, not padding. */
+static int lane_mask( int n, int lanes )
+{
+	return (1 << (n<lanes ? n : lanes)) - 1;
+}
+
+static void pad_f( const double *x, int n, int lanes, float *buf )
+{
+	int i;
+	for(i=0;i<lanes;i++) {
+		buf[i] = x[i<n ? i : n-1];
+	}
+}
+
+__attribute__((target("sse2")))
+static void span_sse2( const double *x, const double *xlo, const double *y, const double *ylo, int n, int max, int *iters )
+{
+	int period = early_outs & EARLY_PERIOD;
+	long long saved = 0;
+	long cycles = 0;
+	double buf[MAX_LANES], ybuf[MAX_LANES], count[2];
+	int i, k;
+
+	for(i=0;i<n;i+=2) {
+		const double *px = pad(x+i,n-i,2,buf);
+		const double *py = pad(y+i,n-i,2,ybuf);
+		__m128d x0 = _mm_loadu_pd(px);
+		__m128d y0 = _mm_loadu_pd(py);
+		__m128d zx = x0, zy = y0;
+		__m128d sx = x0, sy = y0;
+		__m128d done = _mm_setzero_pd();
+		__m128d cnt = _mm_setzero_pd();
+		int valid = lane_mask(n-i,2);
+		const __m128d four = _mm_set1_pd(4), one = _mm_set1_pd(1), two = _mm_set1_pd(2);
+		const __m128d eps = _mm_set1_pd(PERIOD_EPS_DOUBLE), sign = _mm_set1_pd(-0.0);
+
+		for(k=0;k<max;k++) {
+			__m128d xx = _mm_mul_pd(zx,zx);
+			__m128d yy = _mm_mul_pd(zy,zy);
+			__m128d in = _mm_andnot_pd(done,_mm_cmple_pd(_mm_add_pd(xx,yy),four));
+			if(!_mm_movemask_pd(in)) break;
+			cnt = _mm_add_pd(cnt,_mm_and_pd(in,one));
+			__m128d xt = _mm_add_pd(_mm_sub_pd(xx,yy),x0);
+			zy = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(two,zx),zy),y0);
+			zx = xt;
+
+			if(period) {
+				__m128d near = _mm_and_pd(_mm_cmplt_pd(_mm_andnot_pd(sign,_mm_sub_pd(zx,sx)),eps),
+				                  _mm_cmplt_pd(_mm_andnot_pd(sign,_mm_sub_pd(zy,sy)),eps));
+				near = _mm_and_pd(near,in);
+				int m = _mm_movemask_pd(near) & valid;
+				if(m) {
+					done = _mm_or_pd(done,near);
+					cycles += __builtin_popcount(m);
+					saved += (long long)__builtin_popcount(m) * (max-k-1);
+				}
+				if(!((k+1) & k)) {
+					sx = zx;
+					sy = zy;
+				}
+			}
+		}
+
+		_mm_storeu_pd(count,cnt);
+		int cycled = _mm_movemask_pd(done);
+		for(k=0;k<2 && i+k<n;k++) iters[i+k] = cycled & (1<<k) ? max : (int)count[k];
+	}
+	note_periodic(cycles,saved);
+}
+
+__attribute__((target("avx2")))
+static void span_avx2( const double *x, const double *xlo, const double *y, const double *ylo, int n, int max, int *iters )
+{
+	int period = early_outs & EARLY_PERIOD;
+	long long saved = 0;
+	long cycles = 0;
+	double buf[MAX_LANES], ybuf[MAX_LANES], count[4];
+	int i, k;
+
+	for(i=0;i<n;i+=4) {
+		const double *px = pad(x+i,n-i,4,buf);
+		const double *py = pad(y+i,n-i,4,ybuf);
+		__m256d x0 = _mm256_loadu_pd(px);
+		__m256d y0 = _mm256_loadu_pd(py);
+		__m256d zx = x0, zy = y0;
+		__m256d sx = x0, sy = y0;
+		__m256d done = _mm256_setzero_pd();
+		__m256d cnt = _mm256_setzero_pd();
+		int valid = lane_mask(n-i,4);
+		const __m256d four = _mm256_set1_pd(4), one = _mm256_set1_pd(1), two = _mm256_set1_pd(2);
+		const __m256d eps = _mm256_set1_pd(PERIOD_EPS_DOUBLE), sign = _mm256_set1_pd(-0.0);
+
+		for(k=0;k<max;k++) {
+			__m256d xx = _mm256_mul_pd(zx,zx);
+			__m256d yy = _mm256_mul_pd(zy,zy);
+			__m256d in = _mm256_andnot_pd(done,_mm256_cmp_pd(_mm256_add_pd(xx,yy),four,_CMP_LE_OQ));
+			if(!_mm256_movemask_pd(in)) break;
+			cnt = _mm256_add_pd(cnt,_mm256_and_pd(in,one));
+			__m256d xt = _mm256_add_pd(_mm256_sub_pd(xx,yy),x0);
+			zy = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(two,zx),zy),y0);
+			zx = xt;
+
+			if(period) {
+				__m256d near = _mm256_and_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign,_mm256_sub_pd(zx,sx)),eps,_CMP_LT_OQ),
+				                  _mm256_cmp_pd(_mm256_andnot_pd(sign,_mm256_sub_pd(zy,sy)),eps,_CMP_LT_OQ));
+				near = _mm256_and_pd(near,in);
+				int m = _mm256_movemask_pd(near) & valid;
+				if(m) {
+					done = _mm256_or_pd(done,near);
+					cycles += __builtin_popcount(m);
+					saved += (long long)__builtin_popcount(m) * (max-k-1);
+				}
+				if(!((k+1) & k)) {
+					sx = zx;
+					sy = zy;
+				}
+			}
+		}
+
+		_mm256_storeu_pd(count,cnt);
+		int cycled = _mm256_movemask_pd(done);
+		for(k=0;k<4 && i+k<n;k++) iters[i+k] = cycled & (1<<k) ? max : (int)count[k];
+	}
+	note_periodic(cycles,saved);
+}
+
+__attribute__((target("avx512f"),optimize("fp-contract=off")))
+static void span_avx512( const double *x, const double *xlo, const double *y, const double *ylo, int n, int max, int *iters )
+{
+	int period = early_outs & EARLY_PERIOD;
+	long long saved = 0;
+	long cycles = 0;
+	double buf[MAX_LANES], ybuf[MAX_LANES], count[8];
+	int i, k;
+
+	for(i=0;i<n;i+=8) {
+		const double *px = pad(x+i,n-i,8,buf);
+		const double *py = pad(y+i,n-i,8,ybuf);
+		__m512d x0 = _mm512_loadu_pd(px);
+		__m512d y0 = _mm512_loadu_pd(py);
+		__m512d zx = x0, zy = y0;
+		__m512d sx = x0, sy = y0;
+		__mmask8 done = 0;
+		__m512d cnt = _mm512_setzero_pd();
+		int valid = lane_mask(n-i,8);
+		const __m512d four = _mm512_set1_pd(4), one = _mm512_set1_pd(1), two = _mm512_set1_pd(2);
+		const __m512d eps = _mm512_set1_pd(PERIOD_EPS_DOUBLE);
+
+		for(k=0;k<max;k++) {
+			__m512d xx = _mm512_mul_pd(zx,zx);
+			__m512d yy = _mm512_mul_pd(zy,zy);
+			__mmask8 in = _mm512_cmp_pd_mask(_mm512_add_pd(xx,yy),four,_CMP_LE_OQ) & ~done;
+			if(!in) break;
+			cnt = _mm512_mask_add_pd(cnt,in,cnt,one);
+			__m512d xt = _mm512_add_pd(_mm512_sub_pd(xx,yy),x0);
+			zy = _mm512_add_pd(_mm512_mul_pd(_mm512_mul_pd(two,zx),zy),y0);
+			zx = xt;
+
+			if(period) {
+				__mmask8 near = _mm512_mask_cmp_pd_mask(in,_mm512_abs_pd(_mm512_sub_pd(zx,sx)),eps,_CMP_LT_OQ);
+				near = _mm512_mask_cmp_pd_mask(near,_mm512_abs_pd(_mm512_sub_pd(zy,sy)),eps,_CMP_LT_OQ);
+				int m = near & valid;
+				if(m) {
+					done |= near;
+					cycles += __builtin_popcount(m);
+					saved += (long long)__builtin_popcount(m) * (max-k-1);
+				}
+				if(!((k+1) & k)) {
+					sx = zx;
+					sy = zy;
+				}
+			}
+		}
+
+		_mm512_storeu_pd(count,cnt);
+		for(k=0;k<8 && i+k<n;k++) iters[i+k] = done & (1<<k) ? max : (int)count[k];
+	}
+	note_periodic(cycles,saved);
+}
+
+/*
+The float kernels count in integer lanes, a float count would stop
+being exact at 2^24 iterations.  A true compare is all ones, -1.
+*/
+
+__attribute__((target("sse2")))
+static void span_sse2_f( const double *x, const double *xlo, const double *y, const double *ylo, int n, int max, int *iters )
+{
+	int period = early_outs & EARLY_PERIOD;
+	long long saved = 0;
+	long cycles = 0;
+	float buf[MAX_LANES], ybuf[MAX_LANES];
+	int count[4];
+	int i, k;
+
+	for(i=0;i<n;i+=4) {
+		pad_f(x+i,n-i,4,buf);
+		pad_f(y+i,n-i,4,ybuf);
+		__m128 x0 = _mm_loadu_ps(buf);
+		__m128 y0 = _mm_loadu_ps(ybuf);
+		__m128 zx = x0, zy = y0;
+		__m128 sx = x0, sy = y0;
+		__m128 done = _mm_setzero_ps();
+		__m128i cnt = _mm_setzero_si128();
+		int valid = lane_mask(n-i,4);
+		const __m128 four = _mm_set1_ps(4), two = _mm_set1_ps(2);
+		const __m128 eps = _mm_set1_ps(PERIOD_EPS_FLOAT), sign = _mm_set1_ps(-0.0f);
+
+		for(k=0;k<max;k++) {
+			__m128 xx = _mm_mul_ps(zx,zx);
+			__m128 yy = _mm_mul_ps(zy,zy);
+			__m128 in = _mm_andnot_ps(done,_mm_cmple_ps(_mm_add_ps(xx,yy),four));
+			if(!_mm_movemask_ps(in)) break;
+			cnt = _mm_sub_epi32(cnt,_mm_castps_si128(in));
+			__m128 xt = _mm_add_ps(_mm_sub_ps(xx,yy),x0);
+			zy = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(two,zx),zy),y0);
+			zx = xt;
+
+			if(period) {
+				__m128 near = _mm_and_ps(_mm_cmplt_ps(_mm_andnot_ps(sign,_mm_sub_ps(zx,sx)),eps),
+				                  _mm_cmplt_ps(_mm_andnot_ps(sign,_mm_sub_ps(zy,sy)),eps));
+				near = _mm_and_ps(near,in);
+				int m = _mm_movemask_ps(near) & valid;
+				if(m) {
+					done = _mm_or_ps(done,near);
+					cycles += __builtin_popcount(m);
+					saved += (long long)__builtin_popcount(m) * (max-k-1);
+				}
+				if(!((k+1) & k)) {
+					sx = zx;
+					sy = zy;
+				}
+			}
+		}
+
+		_mm_storeu_si128((__m128i *)count,cnt);
+		int cycled = _mm_movemask_ps(done);
+		for(k=0;k<4 && i+k<n;k++) iters[i+k] = cycled & (1<<k) ? max : count[k];
+	}
+	note_periodic(cycles,saved);
+}
+
+__attribute__((target("avx2")))
+static void span_avx2_f( const double *x, const double *xlo, const double *y, const double *ylo, int n, int max, int *iters )
+{
+	int period = early_outs & EARLY_PERIOD;
+	long long saved = 0;
+	long cycles = 0;
+	float buf[MAX_LANES], ybuf[MAX_LANES];
+	int count[8];
+	int i, k;
+
+	for(i=0;i<n;i+=8) {
+		pad_f(x+i,n-i,8,buf);
+		pad_f(y+i,n-i,8,ybuf);
+		__m256 x0 = _mm256_loadu_ps(buf);
+		__m256 y0 = _mm256_loadu_ps(ybuf);
+		__m256 zx = x0, zy = y0;
+		__m256 sx = x0, sy = y0;
+		__m256 done = _mm256_setzero_ps();
+		__m256i cnt = _mm256_setzero_si256();
+		int valid = lane_mask(n-i,8);
+		const __m256 four = _mm256_set1_ps(4), two = _mm256_set1_ps(2);
+		const __m256 eps = _mm256_set1_ps(PERIOD_EPS_FLOAT), sign = _mm256_set1_ps(-0.0f);
+
+		for(k=0;k<max;k++) {
+			__m256 xx = _mm256_mul_ps(zx,zx);
+			__m256 yy = _mm256_mul_ps(zy,zy);
+			__m256 in = _mm256_andnot_ps(done,_mm256_cmp_ps(_mm256_add_ps(xx,yy),four,_CMP_LE_OQ));
+			if(!_mm256_movemask_ps(in)) break;
+			cnt = _mm256_sub_epi32(cnt,_mm256_castps_si256(in));
+			__m256 xt = _mm256_add_ps(_mm256_sub_ps(xx,yy),x0);
+			zy = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(two,zx),zy),y0);
+			zx = xt;
+
+			if(period) {
+				__m256 near = _mm256_and_ps(_mm256_cmp_ps(_mm256_andnot_ps(sign,_mm256_sub_ps(zx,sx)),eps,_CMP_LT_OQ),
+				                  _mm256_cmp_ps(_mm256_andnot_ps(sign,_mm256_sub_ps(zy,sy)),eps,_CMP_LT_OQ));
+				near = _mm256_and_ps(near,in);
+				int m = _mm256_movemask_ps(near) & valid;
+				if(m) {
+					done = _mm256_or_ps(done,near);
+					cycles += __builtin_popcount(m);
+					saved += (long long)__builtin_popcount(m) * (max-k-1);
+				}
+				if(!((k+1) & k)) {
+					sx = zx;
+					sy = zy;
+				}
+			}
+		}
+
+		_mm256_storeu_si256((__m256i *)count,cnt);
+		int cycled = _mm256_movemask_ps(done);
+		for(k=0;k<8 && i+k<n;k++) iters[i+k] = cycled & (1<<k) ? max : count[k];
+	}
+	note_periodic(cycles,saved);
+}
+
+__attribute__((target("avx512f"),optimize("fp-contract=off")))
+static void span_avx512_f( const double *x, const double *xlo, const double *y, const double *ylo, int n, int max, int *iters )
+{
+	int period = early_outs & EARLY_PERIOD;
+	long long saved = 0;
+	long cycles = 0;
+	float buf[MAX_LANES], ybuf[MAX_LANES];
+	int count[16];
+	int i, k;
+
+	for(i=0;i<n;i+=16) {
+		pad_f(x+i,n-i,16,buf);
+		pad_f(y+i,n-i,16,ybuf);
+		__m512 x0 = _mm512_loadu_ps(buf);
+		__m512 y0 = _mm512_loadu_ps(ybuf);
+		__m512 zx = x0, zy = y0;
+		__m512 sx = x0, sy = y0;
+		__mmask16 done = 0;
+		__m512i cnt = _mm512_setzero_si512();
+		int valid = lane_mask(n-i,16);
+		const __m512 four = _mm512_set1_ps(4), two = _mm512_set1_ps(2);
+		const __m512i one = _mm512_set1_epi32(1);
+		const __m512 eps = _mm512_set1_ps(PERIOD_EPS_FLOAT);
+
+		for(k=0;k<max;k++) {
+			__m512 xx = _mm512_mul_ps(zx,zx);
+			__m512 yy = _mm512_mul_ps(zy,zy);
+			__mmask16 in = _mm512_cmp_ps_mask(_mm512_add_ps(xx,yy),four,_CMP_LE_OQ) & ~done;
+			if(!in) break;
+			cnt = _mm512_mask_add_epi32(cnt,in,cnt,one);
+			__m512 xt = _mm512_add_ps(_mm512_sub_ps(xx,yy),x0);
+			zy = _mm512_add_ps(_mm512_mul_ps(_mm512_mul_ps(two,zx),zy),y0);
+			zx = xt;
+
+			if(period) {
+				__mmask16 near = _mm512_mask_cmp_ps_mask(in,_mm512_abs_ps(_mm512_sub_ps(zx,sx)),eps,_CMP_LT_OQ);
+				near = _mm512_mask_cmp_ps_mask(near,_mm512_abs_ps(_mm512_sub_ps(zy,sy)),eps,_CMP_LT_OQ);
+				int m = near & valid;
+				if(m) {
+					done |= near;
+					cycles += __builtin_popcount(m);
+					saved += (long long)__builtin_popcount(m) * (max-k-1);
+				}
+				if(!((k+1) & k)) {
+					sx = zx;
+					sy = zy;
+				}
+			}
+		}
+
+		_mm512_storeu_si512(count,cnt);
+		for(k=0;k<16 && i+k<n;k++) iters[i+k] = done & (1<<k) ? max : count[k];
+	}
+	note_periodic(cycles,saved);
+}
+
+/*
+Return whether x, y is in the main cardioid or the period 2 bulb.
+*/
+
+static int in_bulbs( double x, double y )
+{
+	double xq = x - 0.25;
+	double y2 = y*y;
+	double q = xq*xq + y2;
+
+	if(q*(q + xq) < 0.25*y2 - BULB_MARGIN) return 1;
+	if((x+1)*(x+1) + y2 < 0.0625 - BULB_MARGIN) return 1;
+	return 0;
+}
+
+/*
+Run a kernel on a run of points, with the early outs switched on.  Points in
+the cardioid or the bulb are swapped for one that escapes at once, so
+the kernel spends nothing on them, and then set to max.
+*/
+
+void kernel_span( const struct kernel *k, const double *x, const double *xlo, const double *y, const double *ylo, int n, int max, int *iters )
+{
+	double moved[n];
+	char inside[n];
+	int i, found = 0;
+
+	if(early_outs & EARLY_BULB) {
+		for(i=0;i<n;i++) {
+			inside[i] = in_bulbs(x[i],y[i]);
+			moved[i] = inside[i] ? 4 : x[i];
+			found += inside[i];
+		}
+	}
+
+	k->span(found ? moved : x,xlo,y,ylo,n,max,iters);
+
+	if(found) {
+		for(i=0;i<n;i++) {
+			if(inside[i]) iters[i] = max;
+		}
+		__atomic_fetch_add(&bulb_pixels,found,__ATOMIC_RELAXED);
+		__atomic_fetch_add(&saved_iterations,(long long)found*max,__ATOMIC_RELAXED);
+	}
+}
+
+/*
+Choose the early outs, EARLY_BULB and EARLY_PERIOD or'd together.
+Both are on unless this says otherwise.
+*/
+
+void kernel_early_outs( int which )
+{
+	early_outs = which;
+}
+
+void kernel_early_stats( long *bulb, long *periodic, long long *saved )
+{
+	*bulb = bulb_pixels;
+	*periodic = periodic_pixels;
+	*saved = saved_iterations;
+}
+
+/*
+Widest first within each precision.  Double-double has only the scalar
+kernel; asking it for a vector one gets that.
+*/
+static const struct kernel kernels[] = {
+	{ "avx512", PRECISION_FLOAT,  16, span_avx512_f },
+	{ "avx2",   PRECISION_FLOAT,  8,  span_avx2_f },
+	{ "sse2",   PRECISION_FLOAT,  4,  span_sse2_f },
+	{ "scalar", PRECISION_FLOAT,  1,  span_scalar_f },
+	{ "avx512", PRECISION_DOUBLE, 8,  span_avx512 },
+	{ "avx2",   PRECISION_DOUBLE, 4,  span_avx2 },
+	{ "sse2",   PRECISION_DOUBLE, 2,  span_sse2 },
+	{ "scalar", PRECISION_DOUBLE, 1,  span_scalar },
+	{ "scalar", PRECISION_DD,     1,  span_scalar_dd },
+};
+
+#define NUM_KERNELS (sizeof(kernels)/sizeof(kernels[0]))
+
+static const char *precision_names[] = { "float", "double", "dd", "deep" };
+
+static int supported( const struct kernel *k )
+{
+	__builtin_cpu_init();
+	if(!strcmp(k->name,"avx512")) return __builtin_cpu_supports("avx512f");
+	if(!strcmp(k->name,"avx2"))   return __builtin_cpu_supports("avx2");
+	if(!strcmp(k->name,"sse2"))   return __builtin_cpu_supports("sse2");
+	return 1;
+}
+
+/*
+Return the kernel of the given name and precision, or 0 if there is
+no such name or this CPU cannot run it.  A precision without a kernel
+of that name gets its widest one instead.
+*/
+
+const struct kernel * kernel_select( const char *name, int precision )
+{
+	const struct kernel *found = 0;
+	unsigned i;
+	for(i=0;i<NUM_KERNELS;i++) {
+		if(strcmp(kernels[i].name,name)) continue;
+		if(!supported(&kernels[i])) return 0;
+		if(kernels[i].precision==precision) return &kernels[i];
+		found = &kernels[i];
+	}
+	return found ? kernel_best(precision) : 0;
+}
+
+/*
+Return the widest kernel of a precision this CPU can run.
+*/
+
+const struct kernel * kernel_best( int precision )
+{
+	const struct kernel *last = 0;
+	unsigned i;
+	for(i=0;i<NUM_KERNELS;i++) {
+		if(kernels[i].precision!=precision) continue;
+		if(supported(&kernels[i])) return &kernels[i];
+		last = &kernels[i];
+	}
+	return last;
+}
+
+/*
+Return the cheapest precision that still resolves pixels
+spacing apart in the Mandelbrot space, iterating up to max.
+*/
+
+int precision_for( double spacing, int max )
+{
+	if(spacing >= FLOAT_MIN_SPACING && spacing*max >= FLOAT_MIN_REACH) return PRECISION_FLOAT;
+	if(spacing >= DOUBLE_MIN_SPACING) return PRECISION_DOUBLE;
+	if(spacing >= DD_MIN_SPACING) return PRECISION_DD;
+	return PRECISION_DEEP;
+}
+
+/*
+Return the precision of the given name, auto included,
+or -2 if there is none.
+*/
+
+int precision_parse( const char *name )
+{
+	int i;
+	if(!strcmp(name,"auto")) return PRECISION_AUTO;
+	for(i=0;i<4;i++) {
+		if(!strcmp(name,precision_names[i])) return i;
+	}
+	return -2;
+}
+
+const char * precision_name( int precision )
+{
+	return precision_names[precision];
+}
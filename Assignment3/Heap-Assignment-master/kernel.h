@@ -0,0 +1,41 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+/*
+Escape time kernels.  A kernel iterates a run of pixels, of a row or a
+column, and stores the number of iterations each took to escape, up to
+max.  The vector kernels iterate several pixels per instruction and give
+the same counts as the scalar one of their precision.
+
+Points come as double-double, x[i]+xlo[i] and y[i]+ylo[i].  Only the
+double-double kernels look at the low parts, which may then be 0.
+*/
+
+#define PRECISION_AUTO   -1
+#define PRECISION_FLOAT  0	// float32, twice the lanes of double
+#define PRECISION_DOUBLE 1
+#define PRECISION_DD     2	// double-double, about 106 bits
+#define PRECISION_DEEP   3	// perturbation, see perturb.h; no kernel
+
+struct kernel {
+	const char *name;
+	int precision;
+	int lanes;		// pixels iterated at once
+	void (*span)( const double *x, const double *xlo, const double *y, const double *ylo, int n, int max, int *iters );
+};
+
+#define EARLY_BULB       1	// cardioid and period 2 bulb test
+#define EARLY_PERIOD     2	// stop orbits that cycle
+
+const struct kernel * kernel_select( const char *name, int precision );
+const struct kernel * kernel_best( int precision );
+
+void kernel_span( const struct kernel *k, const double *x, const double *xlo, const double *y, const double *ylo, int n, int max, int *iters );
+void kernel_early_outs( int which );
+void kernel_early_stats( long *bulb, long *periodic, long long *saved );
+
+int          precision_for( double spacing, int max );
+int          precision_parse( const char *name );
+const char * precision_name( int precision );
+
+#endif
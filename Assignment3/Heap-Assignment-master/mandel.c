@@ -1,19 +1,27 @@
 
 #include "bitmap.h"
-#include <pthread.h>
+#include "pool.h"
+#include "kernel.h"
+#include "dd.h"
+#include "perturb.h"
+#include "tilecache.h"
 #include <getopt.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
 #include <errno.h>
 #include <string.h>
-
-#define MAX_NUM_THREADS 100    //Max number of threads we can create.
-                               //if you need more threads increase this.
+#include <time.h>
 
 int iteration_to_color( int i, int max );
-int iterations_at_point( double x, double y, int max );
-void *compute_image( void *threadarg );
+
+#define SPAN_PIXELS 256     // pixels of a tile row handed to the kernel at once
+#define SUBDIVIDE_MIN 16    // rectangles this narrow are computed in full, in whole vectors
+#define SUBDIVIDE_TILE 64   // tile size when subdividing without -g
+#define PROGRESSIVE_STEP 8  // the first progressive pass does every 8th pixel
+#define CACHE_LIMIT_MB 256  // tile cache size unless -C says otherwise
+#define STREAM_BANDS 2      // band buffers per worker when streaming
 
 // information we are sending to each thread for image calculation.
 struct image_thread_data
@@ -23,14 +31,66 @@ struct image_thread_data
     double xmax;
     double ymin;
     double ymax;
+    struct dd xcenter;  // the center and scale again, for kernels
+    struct dd ycenter;  // that need more than double precision.
+    double scale;
     int height;
     int width;
     int iterations;
-    int part_height;
-    int remain_height;
+    const struct kernel *kernel;
+    struct reference *reference;    // instead of the kernel for deep zooms
+    int tile_width;     // size of one unit of work, a whole row when
+    int tile_height;    // tile_width is the image width.
+    int tiles_across;
+    int num_tiles;
+    int subdivide;      // 0 off, 1 fill rectangles inside the set, 2 fill any
+    long filled;        // pixels filled in without computing them
+    int step;           // progressive pass, pixels on this grid; 0 for all
+    void (*frame)( struct bitmap *preview, int step, void *arg );  // after each coarse pass
+    void *frame_arg;
+    struct bitmap *preview;     // the coarse pass, upsampled to full size
+    struct tilecache *cache;    // quadtree tiles kept on disk, or none
+    struct tile_key tile;       // level, max, precision and early outs of the tiles
+    long long grid_x;           // quadtree grid pixel of pixel 0,0
+    long long grid_y;
+    double spacing;             // of the grid, in x and y alike
+    long long first_tx;         // first tile of the grid that the image overlaps
+    long long first_ty;
+    int cache_across;
+    int cache_tiles;
+    int band_top;       // image row that is row 0 of ibm, when it holds one band
+    struct stream *stream;      // bands on their way to the file, or none
+};
+
+// A ring of band buffers between the workers and the writer thread.
+// Bands are taken in order, and band b may only go into its slot once
+// band b-ring has been written out of it.
+struct stream
+{
+    struct bitmap_writer *writer;
+    struct bitmap **slots;
+    int *done;          // band computed into each slot, -1 for none yet
+    int ring;
+    int band_rows;
+    int bands;
+    int height;
+    int next_band;      // the next band a worker takes
+    int written;        // bands written so far
+    int failed;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
 };
 
-pthread_mutex_t mutex;
+void compute_image( struct pool *workers, struct image_thread_data *image_data );
+void compute_tile( void *threadarg, int tile );
+void compute_span( struct image_thread_data *image_data, int i, int j, int n );
+void subdivide_tile( struct image_thread_data *image_data, int start_i, int start_j, int end_i, int end_j );
+void progressive_tile( struct image_thread_data *image_data, int start_i, int start_j, int end_i, int end_j );
+void colorize_row( void *threadarg, int j );
+void upsample_row( void *threadarg, int j );
+void cache_tile( void *threadarg, int item );
+int  compute_stream( struct pool *workers, struct image_thread_data *image_data, int band_rows, const char *outfile );
+void stream_band( void *threadarg, int item );
 
 void show_help()
 {
@@ -44,6 +104,21 @@ void show_help()
 	printf("-H <pixels>  Height of the image in pixels. (default=500)\n");
 	printf("-o <file>    Set output file. (default=mandel.bmp)\n");
 	printf("-n <threads> Number of threads created to compute the image (default = 1)\n");
+	printf("-k <kernel>  Escape time kernel: avx512, avx2, sse2 or scalar. (default=widest the CPU has)\n");
+	printf("-p <prec>    Precision: float, double, dd (double-double), deep (perturbation) or auto. (default=auto, by pixel size and max)\n");
+	printf("-e <outs>    Early outs for points in the set: all, bulb (cardioid and bulb test),\n");
+	printf("             period (orbit cycle detection) or none. (default=all)\n");
+	printf("-M <level>   Mariani-Silver subdivision: 0 off, 1 fill only rectangles bordered by points\n");
+	printf("             in the set, 2 fill any uniform rectangle. (default=0)  0 is brute force; 1 differs\n");
+	printf("             only where a filament slips between border pixels.\n");
+	printf("-P           Progressive: every 8th pixel first, then every 4th, 2nd and 1st, writing each\n");
+	printf("             coarse pass upsampled to <file>-8.bmp, <file>-4.bmp and <file>-2.bmp.\n");
+	printf("-c <dir>     Keep quadtree tiles of iteration counts in <dir> and reuse them.  The view\n");
+	printf("             snaps to the tile grid whose pixels are the size asked for or smaller.\n");
+	printf("-C <MB>      Size limit of the tile cache, least recently used tiles go first. (default=%d)\n",CACHE_LIMIT_MB);
+	printf("-B <rows>    Stream the image to the file in bands of <rows> rows, from a ring of %d band\n",STREAM_BANDS);
+	printf("             buffers per thread, instead of holding all of it in memory.\n");
+	printf("-g <grain>   Work handed to a thread at a time, <rows> or tiles of <W>x<H> pixels. (default=1)\n");
 	printf("-h           Show this help text.\n");
 	printf("\nSome examples are:\n");
 	printf("mandel -x -0.5 -y -0.5 -s 0.2\n");
@@ -51,6 +126,40 @@ void show_help()
 	printf("mandel -x 0.286932 -y 0.014287 -s .0005 -m 1000\n\n");
 }
 
+// Round down, for tiles left of and above the origin
+static long long floor_div( long long a, long long b )
+{
+    return a >= 0 ? a/b : -((-a + b - 1)/b);
+}
+
+// where the progressive passes go
+struct frame_files
+{
+    const char *outfile;
+    struct timespec start;
+};
+
+// Save a coarse pass next to the output file, as <file>-<step>.bmp
+static void write_frame( struct bitmap *preview, int step, void *arg )
+{
+    struct frame_files *frames = (struct frame_files *) arg;
+    size_t len = strlen(frames->outfile);
+    char name[len + 16];
+    struct timespec now;
+
+    if (len > 4 && !strcmp(frames->outfile + len - 4, ".bmp")) len -= 4;
+    snprintf(name, sizeof(name), "%.*s-%d.bmp", (int)len, frames->outfile, step);
+
+    if (!bitmap_save(preview,name))
+    {
+        fprintf(stderr,"mandel: couldn't write to %s: %s\n",name,strerror(errno));
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    printf("mandel: wrote %s, 1 in %d pixels computed, after %.3fs\n", name, step*step,
+           (now.tv_sec - frames->start.tv_sec) + (now.tv_nsec - frames->start.tv_nsec)/1e9);
+}
+
 int main( int argc, char *argv[] )
 {
 	char c;
@@ -60,25 +169,46 @@ int main( int argc, char *argv[] )
 	const char *outfile = "mandel.bmp";
 	double xcenter = 0;
 	double ycenter = 0;
+	struct dd xcenter_dd = dd_make(0,0);
+	struct dd ycenter_dd = dd_make(0,0);
 	double scale = 4;
+	const char *xcenter_str = "0";     // as typed, for the deep zoom reference
+	const char *ycenter_str = "0";
+	const char *scale_str = "4";
 	int    image_width = 500;
 	int    image_height = 500;
 	int    max = 1000;
 	int    num_of_threads = 1;
+	int    tile_width = 0;
+	int    tile_height = 1;
+	int    grain_given = 0;
+	int    subdivide = 0;
+	int    progressive = 0;
+	const char *cache_dir = 0;
+	long long cache_limit = CACHE_LIMIT_MB;
+	int    early_outs = EARLY_BULB|EARLY_PERIOD;
+	int    band_rows = 0;
+	const char *kernel_name = 0;
+	int    precision = PRECISION_AUTO;
 
 	// For each command line argument given,
 	// override the appropriate configuration value.
 
-	while((c = getopt(argc,argv,"x:y:s:W:H:m:n:o:h"))!=-1) {
+	while((c = getopt(argc,argv,"x:y:s:W:H:m:n:g:k:p:e:M:Pc:C:B:o:h"))!=-1) {
 		switch(c) {
 			case 'x':
 				xcenter = atof(optarg);
+				xcenter_dd = dd_parse(optarg);
+				xcenter_str = optarg;
 				break;
 			case 'y':
 				ycenter = atof(optarg);
+				ycenter_dd = dd_parse(optarg);
+				ycenter_str = optarg;
 				break;
 			case 's':
 				scale = atof(optarg);
+				scale_str = optarg;
 				break;
 			case 'W':
 				image_width = atoi(optarg);
@@ -92,6 +222,52 @@ int main( int argc, char *argv[] )
             case 'n':
 				num_of_threads = atoi(optarg);
 				break;
+			case 'g':
+				if(sscanf(optarg,"%dx%d",&tile_width,&tile_height)!=2) {
+					tile_width = 0;
+					tile_height = atoi(optarg);
+				}
+				grain_given = 1;
+				break;
+			case 'M':
+				subdivide = atoi(optarg);
+				if(subdivide < 0 || subdivide > 2) {
+					fprintf(stderr,"mandel: unknown subdivision level %s\n",optarg);
+					exit(1);
+				}
+				break;
+			case 'P':
+				progressive = 1;
+				break;
+			case 'c':
+				cache_dir = optarg;
+				break;
+			case 'C':
+				cache_limit = atoll(optarg);
+				break;
+			case 'B':
+				band_rows = atoi(optarg);
+				break;
+			case 'k':
+				kernel_name = optarg;
+				break;
+			case 'p':
+				precision = precision_parse(optarg);
+				if(precision<PRECISION_AUTO) {
+					fprintf(stderr,"mandel: unknown precision %s\n",optarg);
+					exit(1);
+				}
+				break;
+			case 'e':
+				if(!strcmp(optarg,"all"))         early_outs = EARLY_BULB|EARLY_PERIOD;
+				else if(!strcmp(optarg,"bulb"))   early_outs = EARLY_BULB;
+				else if(!strcmp(optarg,"period")) early_outs = EARLY_PERIOD;
+				else if(!strcmp(optarg,"none"))   early_outs = 0;
+				else {
+					fprintf(stderr,"mandel: unknown early outs %s\n",optarg);
+					exit(1);
+				}
+				break;
 			case 'o':
 				outfile = optarg;
 				break;
@@ -102,19 +278,135 @@ int main( int argc, char *argv[] )
 		}
 	}
 
-	if (num_of_threads < 1 || num_of_threads > MAX_NUM_THREADS)
+	kernel_early_outs(early_outs);
+
+	if (num_of_threads < 1)
     {
-        printf("Number of threads can only be between 1 to %d\n", MAX_NUM_THREADS);
+        printf("Number of threads must be at least 1\n");
         num_of_threads = 1;
     }
+	if (image_width < 1 || image_height < 1)
+	{
+		printf("Image must be at least 1x1 pixels\n");
+		if (image_width < 1) image_width = 1;
+		if (image_height < 1) image_height = 1;
+	}
+	if (band_rows < 0)
+	{
+		printf("Bands must be at least 1 row, rendering without streaming\n");
+		band_rows = 0;
+	}
+	if (band_rows > image_height) band_rows = image_height;
+	if (band_rows && (cache_dir || subdivide || progressive))
+	{
+		printf("Streaming computes whole bands in order, rendering without the tile cache, subdivision or progressive passes\n");
+		cache_dir = 0;
+		subdivide = progressive = 0;
+	}
+	if (cache_dir && (subdivide || progressive))
+	{
+		printf("The tile cache computes whole tiles, rendering without subdivision or progressive passes\n");
+		subdivide = progressive = 0;
+	}
+	if (subdivide && progressive)
+	{
+		printf("Subdivision and progressive passes don't mix, rendering without subdivision\n");
+		subdivide = 0;
+	}
+	// Subdivision needs tiles with an inside to skip.
+	if (subdivide && !grain_given)
+	{
+		tile_width = tile_height = SUBDIVIDE_TILE;
+	}
+	if (tile_height < 1 || tile_width < 0)
+    {
+        printf("Grain must be a number of rows or <W>x<H> pixels\n");
+        tile_width = 0;
+        tile_height = 1;
+    }
+	if (tile_width == 0 || tile_width > image_width) tile_width = image_width;
+	if (tile_height > image_height) tile_height = image_height;
+
+	// The tile cache computes on the quadtree grid, so the view snaps to the
+	// level whose pixels are the size asked for or the next smaller one.
+	int    level = 0;
+	double spacing = 4.0/TILE_PIXELS;
+	long long grid_x = 0, grid_y = 0;
+	char   snapped_scale[32];
+	if (cache_dir)
+	{
+		int pixels = image_width > image_height ? image_width : image_height;
+		while (spacing > 2*scale/pixels && level < TILE_LEVELS - 1)
+		{
+			level++;
+			spacing /= 2;
+		}
+		if (spacing > 2*scale/pixels)
+		{
+			printf("The tile cache goes down to pixels of %g, rendering without it\n",spacing);
+			cache_dir = 0;
+		}
+	}
+	if (cache_dir)
+	{
+		int pixels = image_width > image_height ? image_width : image_height;
+		grid_x = llround(xcenter/spacing - image_width/2.0);
+		grid_y = llround(ycenter/spacing - image_height/2.0);
+		xcenter = (grid_x + image_width/2.0)*spacing;
+		ycenter = (grid_y + image_height/2.0)*spacing;
+		scale = pixels*spacing/2;
+		xcenter_dd = dd_make(xcenter,0);
+		ycenter_dd = dd_make(ycenter,0);
+		snprintf(snapped_scale,sizeof(snapped_scale),"%.17g",scale);
+		scale_str = snapped_scale;
+		printf("mandel: tile cache level %d, view snapped to x=%.17g y=%.17g\n",level,xcenter,ycenter);
+	}
+
+	// The cheapest precision that still tells neighbouring pixels apart.
+	if (precision == PRECISION_AUTO)
+	{
+		int pixels = image_width > image_height ? image_width : image_height;
+		precision = precision_for(2*scale/pixels,max);
+	}
+	if (cache_dir && precision == PRECISION_DEEP)
+	{
+		printf("The tile cache can't hold perturbation tiles, rendering without it\n");
+		cache_dir = 0;
+	}
+	// Deep zooms have no kernel, they follow a reference orbit.
+	const struct kernel *kernel = 0;
+	struct reference *reference = 0;
+	if (precision == PRECISION_DEEP)
+	{
+		reference = reference_create(xcenter_str,ycenter_str,scale_str,max);
+		if (!reference)
+		{
+			fprintf(stderr,"mandel: out of memory for the reference orbit\n");
+			exit(1);
+		}
+	}
+	else
+	{
+		kernel = kernel_name ? kernel_select(kernel_name,precision) : kernel_best(precision);
+		if (!kernel)
+		{
+			fprintf(stderr,"mandel: kernel %s is unknown or not supported by this CPU\n",kernel_name);
+			exit(1);
+		}
+	}
+
 	// Display the configuration of the image.
-	printf("mandel: x=%lf y=%lf scale=%lf max=%d num_of_threads=%d outfile=%s\n",xcenter,ycenter,scale,max,num_of_threads,outfile);
+	printf("mandel: x=%lf y=%lf scale=%s max=%d num_of_threads=%d kernel=%s precision=%s outfile=%s\n",xcenter,ycenter,scale_str,max,num_of_threads,kernel ? kernel->name : "perturbation",precision_name(precision),outfile);
 
-	// Create a bitmap of the appropriate size.
-	struct bitmap *bm = bitmap_create(image_width,image_height);
+	// Create a bitmap of the appropriate size, unless it is streamed a band at a time.
+	struct bitmap *bm = 0;
+	if (!band_rows)
+	{
+		bm = bitmap_create(image_width,image_height);
 
-	// Fill it with a dark blue, for debugging
-	bitmap_reset(bm,MAKE_RGBA(0,0,255,0));
+		// Fill it with a dark blue, for debugging
+		bitmap_reset(bm,MAKE_RGBA(0,0,255,0));
+	}
 
 	// sending below data to a all threads to create its portion of the image
 	struct image_thread_data part_image;
@@ -123,37 +415,124 @@ int main( int argc, char *argv[] )
     part_image.xmax = xcenter+scale;
     part_image.ymin = ycenter-scale;
     part_image.ymax = ycenter+scale;
+    // the low part is whatever of the typed digits did not fit in a double
+    part_image.xcenter = dd_make(xcenter, dd_add_d(xcenter_dd, -xcenter).hi);
+    part_image.ycenter = dd_make(ycenter, dd_add_d(ycenter_dd, -ycenter).hi);
+    part_image.scale = scale;
     part_image.width = image_width;
     part_image.height = image_height;
     part_image.iterations = max;
-    part_image.part_height = image_height/num_of_threads;  // height of portion of the image each thread creates.
-    part_image.remain_height = image_height%num_of_threads; // reminder height after dividing image between each threads.
+    part_image.kernel = kernel;
+    part_image.reference = reference;
+    part_image.tile_width = tile_width;
+    part_image.tile_height = tile_height;
+    part_image.tiles_across = (image_width + tile_width - 1)/tile_width;
+    part_image.num_tiles = part_image.tiles_across * ((image_height + tile_height - 1)/tile_height);
+    part_image.subdivide = subdivide;
+    part_image.filled = 0;
+    part_image.step = 0;
+    part_image.frame = 0;
+    part_image.frame_arg = 0;
+    part_image.preview = 0;
+    part_image.cache = 0;
+    part_image.band_top = 0;
+    part_image.stream = 0;
 
-	pthread_t thread_id[MAX_NUM_THREADS];
-
-    pthread_mutex_init( & mutex, NULL );
+    struct frame_files frames;
+    if (progressive)
+    {
+        frames.outfile = outfile;
+        clock_gettime(CLOCK_MONOTONIC, &frames.start);
+        part_image.frame = write_frame;
+        part_image.frame_arg = &frames;
+        part_image.preview = bitmap_create(image_width,image_height);
+    }
 
-	int i;
-    // Creates user specified number of threads to generate the image.
-	for (i=0;i<num_of_threads;i++)
+    if (cache_dir)
     {
-        if(pthread_create(&thread_id[i], NULL, compute_image, (void *) &part_image))
+        part_image.cache = tilecache_open(cache_dir, cache_limit*1024*1024);
+        if (!part_image.cache)
         {
-            perror("Error creating thread: ");
-            exit( EXIT_FAILURE );
+            fprintf(stderr,"mandel: couldn't open tile cache %s: %s\n",cache_dir,strerror(errno));
+            exit(1);
         }
+        // square pixels, however wide the image is
+        part_image.xmin = grid_x*spacing;
+        part_image.xmax = (grid_x + image_width)*spacing;
+        part_image.ymin = grid_y*spacing;
+        part_image.ymax = (grid_y + image_height)*spacing;
+        part_image.tile.level = level;
+        part_image.tile.max = max;
+        part_image.tile.precision = precision;
+        part_image.tile.early_outs = early_outs;
+        part_image.grid_x = grid_x;
+        part_image.grid_y = grid_y;
+        part_image.spacing = spacing;
+        part_image.first_tx = floor_div(grid_x, TILE_PIXELS);
+        part_image.first_ty = floor_div(grid_y, TILE_PIXELS);
+        part_image.cache_across = floor_div(grid_x + image_width - 1, TILE_PIXELS) - part_image.first_tx + 1;
+        part_image.cache_tiles = part_image.cache_across *
+            (floor_div(grid_y + image_height - 1, TILE_PIXELS) - part_image.first_ty + 1);
     }
-    // waiting in the loop for all threads to complete.
-    for (i=0;i<num_of_threads;i++)
+
+    // The workers are started once and sleep between images.
+    struct pool *workers = pool_create(num_of_threads);
+    if (!workers)
     {
-        if(pthread_join(thread_id[i], NULL))
-        {
-            perror("Problem with pthread_join: ");
-        }
+        perror("Error creating threads: ");
+        exit( EXIT_FAILURE );
+    }
+
+    int streamed = 1;
+    if (band_rows)
+    {
+        streamed = compute_stream(workers, &part_image, band_rows, outfile);
+    }
+    else
+    {
+        compute_image(workers, &part_image);
+    }
+    pool_delete(workers);
+    if (part_image.preview)
+    {
+        bitmap_delete(part_image.preview);
+    }
+
+    if (part_image.cache)
+    {
+        long hits, misses, evicted;
+        int tiles;
+        long long bytes;
+        tilecache_stats(part_image.cache,&hits,&misses,&evicted,&tiles,&bytes);
+        printf("mandel: tile cache %ld hits, %ld misses, %ld evicted; %d tiles, %.1f MB in %s\n",
+               hits,misses,evicted,tiles,bytes/1048576.0,cache_dir);
+        tilecache_close(part_image.cache);
     }
 
-	// Save the image in the stated file.
-	if(!bitmap_save(bm,outfile))
+    if (subdivide)
+    {
+        printf("mandel: subdivision filled %ld of %ld pixels\n",
+               part_image.filled,(long)image_width*image_height);
+    }
+
+    long bulb, periodic;
+    long long saved;
+    kernel_early_stats(&bulb,&periodic,&saved);
+    if (bulb || periodic)
+    {
+        printf("mandel: early outs saved %lld iterations: %ld pixels in the cardioid or bulb, %ld cycling\n",
+               saved,bulb,periodic);
+    }
+
+    if (reference)
+    {
+        printf("mandel: reference orbit of %d iterations in %d bits, %ld rebases\n",
+               reference_length(reference),reference_bits(reference),reference_rebases(reference));
+        reference_delete(reference);
+    }
+
+	// Save the image in the stated file, if it wasn't streamed there.
+	if(band_rows ? !streamed : !bitmap_save(bm,outfile))
     {
 		fprintf(stderr,"mandel: couldn't write to %s: %s\n",outfile,strerror(errno));
 		return 1;
@@ -168,75 +547,495 @@ Scale the image to the range (xmin-xmax,ymin-ymax), limiting iterations to "max"
 */
 
 // Compute the Mandelbrot image
-void *compute_image( void *threadarg )
+void compute_image( struct pool *workers, struct image_thread_data *image_data )
+{
+    // Whole quadtree tiles, read from the cache where they are there.
+    if (image_data->cache)
+    {
+        pool_run(workers, cache_tile, image_data, image_data->cache_tiles);
+        pool_run(workers, colorize_row, image_data, image_data->height);
+        return;
+    }
+
+    // Coarse to fine: every 8th pixel, then those on the grids of every
+    // 4th, 2nd and 1st pixel that the passes before have not done, so no
+    // pixel is computed twice.  Each coarse pass is shown upsampled.
+    if (image_data->frame)
+    {
+        int step;
+        for(step=PROGRESSIVE_STEP;step>1;step/=2)
+        {
+            image_data->step = step;
+            pool_run(workers, compute_tile, image_data, image_data->num_tiles);
+            pool_run(workers, upsample_row, image_data, image_data->height);
+            image_data->frame(image_data->preview, step, image_data->frame_arg);
+        }
+        image_data->step = 1;
+    }
+
+    // Every worker starts on its own run of tiles and steals from the
+    // others once it is through, so workers that drew cheap tiles outside
+    // the set help out with the expensive ones instead of waiting.
+    pool_run(workers, compute_tile, image_data, image_data->num_tiles);
+
+    // The bitmap holds iteration counts until every tile is done, so
+    // subdivision can compare them.  Now they become colors.
+    pool_run(workers, colorize_row, image_data, image_data->height);
+}
+
+/*
+Compute the image a band of rows at a time and write it to outfile as
+it goes.  Memory holds the ring of bands, not the image.  The workers
+compute bands, colors and all, and a writer thread turns each band into
+BMP scanlines in order, freeing its slot for the band ring places on.
+*/
+
+static void * stream_writer( void *arg )
+{
+    struct stream *s = (struct stream *) arg;
+    int band;
+
+    for(band=0;band<s->bands;band++)
+    {
+        int slot = band % s->ring;
+        int top = band*s->band_rows;
+        int rows = top + s->band_rows < s->height ? s->band_rows : s->height - top;
+
+        pthread_mutex_lock(&s->lock);
+        while (s->done[slot] != band)
+        {
+            pthread_cond_wait(&s->changed, &s->lock);
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        // after a failure keep freeing slots, so the workers finish
+        if (!s->failed && !bitmap_writer_rows(s->writer, s->slots[slot], rows))
+        {
+            s->failed = 1;
+        }
+
+        pthread_mutex_lock(&s->lock);
+        s->written = band + 1;
+        pthread_cond_broadcast(&s->changed);
+        pthread_mutex_unlock(&s->lock);
+    }
+    return 0;
+}
+
+// Free the ring of a stream
+static void stream_free( struct stream *s )
+{
+    int i;
+    for(i=0;s->slots && i<s->ring;i++)
+    {
+        if (s->slots[i]) bitmap_delete(s->slots[i]);
+    }
+    free(s->slots);
+    free(s->done);
+    pthread_cond_destroy(&s->changed);
+    pthread_mutex_destroy(&s->lock);
+}
+
+// Stream the image to outfile in bands of band_rows, returning 0 if it couldn't be written
+int compute_stream( struct pool *workers, struct image_thread_data *image_data, int band_rows, const char *outfile )
+{
+    struct stream s;
+    pthread_t writer;
+    int i, ok;
+
+    memset(&s, 0, sizeof(s));
+    s.ring = STREAM_BANDS*pool_size(workers);
+    s.band_rows = band_rows;
+    s.bands = (image_data->height + band_rows - 1)/band_rows;
+    s.height = image_data->height;
+    pthread_mutex_init(&s.lock, 0);
+    pthread_cond_init(&s.changed, 0);
+
+    s.slots = calloc(s.ring, sizeof(struct bitmap *));
+    s.done = malloc(s.ring*sizeof(int));
+    for(i=0;s.slots && s.done && i<s.ring;i++)
+    {
+        s.slots[i] = bitmap_create(image_data->width, band_rows);
+        s.done[i] = -1;
+        if (!s.slots[i]) break;
+    }
+    if (!s.slots || !s.done || i < s.ring)
+    {
+        stream_free(&s);
+        errno = ENOMEM;
+        return 0;
+    }
+
+    s.writer = bitmap_writer_open(outfile, image_data->width, image_data->height);
+    if (!s.writer)
+    {
+        stream_free(&s);
+        return 0;
+    }
+    if ((errno = pthread_create(&writer, 0, stream_writer, &s)))
+    {
+        bitmap_writer_close(s.writer);
+        stream_free(&s);
+        return 0;
+    }
+
+    image_data->stream = &s;
+    pool_run(workers, stream_band, image_data, s.bands);
+    image_data->stream = 0;
+
+    pthread_join(writer, 0);
+    ok = bitmap_writer_close(s.writer) && !s.failed;
+    printf("mandel: streamed %d bands of %d rows through %d band buffers of %.1f MB\n",
+           s.bands, band_rows, s.ring, (double)image_data->width*band_rows*sizeof(int)/1048576);
+
+    stream_free(&s);
+    return ok;
+}
+
+// Compute the next band of a streamed image, in colors, into its slot of the ring
+void stream_band( void *threadarg, int item )
 {
-    // this is the critical region in the program.
-    // giving thread number for each thread starting from 1
-    pthread_mutex_lock( &mutex );
-        int static num_time_in_this_func;
-        num_time_in_this_func++;
-        int thread_num = num_time_in_this_func;
-    pthread_mutex_unlock( &mutex );
+    struct image_thread_data *image_data;
+    image_data = (struct image_thread_data *) threadarg;
+    struct stream *s = image_data->stream;
+
+    // bands are taken in order whatever the item, so the writer never
+    // waits on a band behind ones that are stuck waiting for its slot
+    int band = __atomic_fetch_add(&s->next_band, 1, __ATOMIC_RELAXED);
+    int slot = band % s->ring;
+    int top = band*s->band_rows;
+    int rows = top + s->band_rows < s->height ? s->band_rows : s->height - top;
+    int i,j;
+
+    pthread_mutex_lock(&s->lock);
+    while (s->written <= band - s->ring)
+    {
+        pthread_cond_wait(&s->changed, &s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    struct image_thread_data part = *image_data;
+    part.ibm = s->slots[slot];
+    part.band_top = top;
+    for(j=0;j<rows;j++)
+    {
+        compute_span(&part, 0, top + j, part.width);
+        for(i=0;i<part.width;i++)
+        {
+            bitmap_set(part.ibm,i,j,iteration_to_color(bitmap_get(part.ibm,i,j),part.iterations));
+        }
+    }
 
+    pthread_mutex_lock(&s->lock);
+    s->done[slot] = band;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Compute one tile of the Mandelbrot image
+void compute_tile( void *threadarg, int tile )
+{
     struct image_thread_data *image_data;
     image_data = (struct image_thread_data *) threadarg;
 
-	// distributing remaining image after equal division to first few threads.
-	int i,j,extra_start_j,extra_end_j;
-    if (image_data->remain_height < thread_num)
+    int start_i = (tile % image_data->tiles_across) * image_data->tile_width;
+    int start_j = (tile / image_data->tiles_across) * image_data->tile_height;
+    int end_i = start_i + image_data->tile_width;
+    int end_j = start_j + image_data->tile_height;
+    if (end_i > image_data->width) end_i = image_data->width;
+    if (end_j > image_data->height) end_j = image_data->height;
+
+    if (image_data->subdivide)
     {
-        extra_start_j = image_data->remain_height;
-        extra_end_j = image_data->remain_height;
+        subdivide_tile(image_data, start_i, start_j, end_i, end_j);
+        return;
     }
-    else
+    if (image_data->step)
+    {
+        progressive_tile(image_data, start_i, start_j, end_i, end_j);
+        return;
+    }
+
+    // For every row of the tile...
+    int j;
+    for(j=start_j;j<end_j;j++)
+    {
+        compute_span(image_data, start_i, j, end_i - start_i);
+    }
+}
+
+// Compute n pixels from i,j on, stepping by di,dj, storing their iteration counts
+static void compute_run( struct image_thread_data *image_data, int i, int j, int n, int di, int dj )
+{
+    double x[SPAN_PIXELS], xlo[SPAN_PIXELS];
+    double y[SPAN_PIXELS], ylo[SPAN_PIXELS];
+    int iters[SPAN_PIXELS];
+    int k,left;
+    int dd = image_data->kernel && image_data->kernel->precision == PRECISION_DD;
+
+    memset(xlo,0,sizeof(xlo));
+    memset(ylo,0,sizeof(ylo));
+
+    // A span of pixels at a time...
+    for(left=n;left>0;left-=n)
     {
-        extra_start_j = thread_num - 1;
-        extra_end_j = thread_num;
+        n = left < SPAN_PIXELS ? left : SPAN_PIXELS;
+
+        // Determine the points in x,y space for those pixels.
+        for(k=0;k<n;k++)
+        {
+            int pi = i + k*di, pj = j + k*dj;
+            if (dd)
+            {
+                // the offset from the center is small, double holds it
+                struct dd xd = dd_add_d(image_data->xcenter, -image_data->scale + pi*(2*image_data->scale)/image_data->width);
+                struct dd yd = dd_add_d(image_data->ycenter, -image_data->scale + pj*(2*image_data->scale)/image_data->height);
+                x[k] = xd.hi;
+                xlo[k] = xd.lo;
+                y[k] = yd.hi;
+                ylo[k] = yd.lo;
+            }
+            else
+            {
+                x[k] = image_data->xmin + pi*(image_data->xmax-image_data->xmin)/image_data->width;
+                y[k] = image_data->ymin + pj*(image_data->ymax-image_data->ymin)/image_data->height;
+            }
+        }
+
+        // Compute the iterations at those points.
+        if (image_data->reference && (di != 1 || dj))
+        {
+            // the reference takes runs of a row, anything else is a pixel at a time
+            for(k=0;k<n;k++)
+            {
+                reference_span(image_data->reference,i+k*di,j+k*dj,1,image_data->width,image_data->height,iters+k);
+            }
+        }
+        else if (image_data->reference)
+        {
+            reference_span(image_data->reference,i,j,n,image_data->width,image_data->height,iters);
+        }
+        else
+        {
+            kernel_span(image_data->kernel,x,xlo,y,ylo,n,image_data->iterations,iters);
+        }
+
+        // Set the pixels in the bitmap.
+        for(k=0;k<n;k++)
+        {
+            bitmap_set(image_data->ibm,i+k*di,j+k*dj - image_data->band_top,iters[k]);
+        }
+        i += n*di;
+        j += n*dj;
     }
+}
 
-	// For every pixel in the image portion of this thread...
-	for(j = (image_data->part_height * (thread_num - 1) + extra_start_j);
-	    j < image_data->part_height * thread_num + extra_end_j ;j++)
+// Compute n pixels of row j from column i on
+void compute_span( struct image_thread_data *image_data, int i, int j, int n )
+{
+    compute_run(image_data, i, j, n, 1, 0);
+}
+
+// Compute column i from row start_j up to end_j
+static void compute_column( struct image_thread_data *image_data, int i, int start_j, int end_j )
+{
+    compute_run(image_data, i, start_j, end_j - start_j, 0, 1);
+}
+
+// Compute the pixels of a tile that are on this pass's grid and not on the last one's
+void progressive_tile( struct image_thread_data *image_data, int start_i, int start_j, int end_i, int end_j )
+{
+    int step = image_data->step;
+    int first_i = (start_i + step - 1)/step*step;
+    int i,j;
+
+    for(j=(start_j + step - 1)/step*step;j<end_j;j+=step)
     {
-		for(i=0;i<image_data->width;i++)
+        if (step < PROGRESSIVE_STEP && j % (2*step) == 0)
+        {
+            // the pass before did every other pixel of this row
+            i = first_i % (2*step) ? first_i : first_i + step;
+            if (i < end_i)
+            {
+                compute_run(image_data, i, j, (end_i - i + 2*step - 1)/(2*step), 2*step, 0);
+            }
+        }
+        else if (first_i < end_i)
         {
-			// Determine the point in x,y space for that pixel.
-			double x = image_data->xmin + i*(image_data->xmax-image_data->xmin)/image_data->width;
-			double y = image_data->ymin + j*(image_data->ymax-image_data->ymin)/image_data->height;
+            compute_run(image_data, first_i, j, (end_i - first_i + step - 1)/step, step, 0);
+        }
+    }
+}
 
-			// Compute the iterations at that point.
-			int iters = iterations_at_point(x,y,image_data->iterations);
+// Return the count all around the border of the rectangle, or -1 if it varies
+static int uniform_border( struct image_thread_data *image_data, int i0, int j0, int i1, int j1 )
+{
+    struct bitmap *bm = image_data->ibm;
+    int value = bitmap_get(bm,i0,j0);
+    int i,j;
 
-			// Set the pixel in the bitmap.
-			bitmap_set(image_data->ibm,i,j,iters);
-		}
-	}
+    for(i=i0;i<=i1;i++)
+    {
+        if (bitmap_get(bm,i,j0) != value || bitmap_get(bm,i,j1) != value) return -1;
+    }
+    for(j=j0;j<=j1;j++)
+    {
+        if (bitmap_get(bm,i0,j) != value || bitmap_get(bm,i1,j) != value) return -1;
+    }
+    return value;
 }
 
 /*
-Return the number of iterations at point x, y
-in the Mandelbrot space, up to a maximum of max.
+Mariani-Silver subdivision.  The border of the rectangle from i0,j0 to
+i1,j1, both corners included, is computed.  If it is the same count all
+around, so is the inside, as the Mandelbrot set is connected: fill it in.
+Otherwise compute a line across the middle and do the same for each half.
+Only a border of points in the set is sure to hold; a border of one
+escape count can hide a small copy of the set, level 2 fills it anyway.
 */
 
-int iterations_at_point( double x, double y, int max )
+static long subdivide( struct image_thread_data *image_data, int i0, int j0, int i1, int j1 )
 {
-	double x0 = x;
-	double y0 = y;
+    int i,j,m;
 
-	int iter = 0;
+    if (i1 - i0 < 2 || j1 - j0 < 2) return 0;
 
-	while( (x*x + y*y <= 4) && iter < max ) {
+    int value = uniform_border(image_data, i0, j0, i1, j1);
+    if (value >= 0 && (image_data->subdivide >= 2 || value == image_data->iterations))
+    {
+        for(j=j0+1;j<j1;j++)
+        {
+            for(i=i0+1;i<i1;i++)
+            {
+                bitmap_set(image_data->ibm,i,j,value);
+            }
+        }
+        return (long)(i1-i0-1)*(j1-j0-1);
+    }
 
-		double xt = x*x - y*y + x0;
-		double yt = 2*x*y + y0;
+    if (i1 - i0 <= SUBDIVIDE_MIN || j1 - j0 <= SUBDIVIDE_MIN)
+    {
+        for(j=j0+1;j<j1;j++)
+        {
+            compute_span(image_data, i0+1, j, i1-i0-1);
+        }
+        return 0;
+    }
 
-		x = xt;
-		y = yt;
+    // split across the longer side
+    if (i1 - i0 >= j1 - j0)
+    {
+        m = (i0 + i1)/2;
+        compute_column(image_data, m, j0+1, j1);
+        return subdivide(image_data, i0, j0, m, j1) + subdivide(image_data, m, j0, i1, j1);
+    }
+    m = (j0 + j1)/2;
+    compute_span(image_data, i0+1, m, i1-i0-1);
+    return subdivide(image_data, i0, j0, i1, m) + subdivide(image_data, i0, m, i1, j1);
+}
 
-		iter++;
-	}
+// Compute a tile by subdividing it, starting from its border
+void subdivide_tile( struct image_thread_data *image_data, int start_i, int start_j, int end_i, int end_j )
+{
+    compute_span(image_data, start_i, start_j, end_i - start_i);
+    if (end_j - start_j > 1)
+    {
+        compute_span(image_data, start_i, end_j - 1, end_i - start_i);
+    }
+    compute_column(image_data, start_i, start_j + 1, end_j - 1);
+    if (end_i - start_i > 1)
+    {
+        compute_column(image_data, end_i - 1, start_j + 1, end_j - 1);
+    }
+
+    long filled = subdivide(image_data, start_i, start_j, end_i - 1, end_j - 1);
+    __atomic_fetch_add(&image_data->filled, filled, __ATOMIC_RELAXED);
+}
+
+// Compute the counts of a whole quadtree tile
+static void compute_grid_tile( struct image_thread_data *image_data, const struct tile_key *key, int *counts )
+{
+    double x[TILE_PIXELS], y[TILE_PIXELS], lo[TILE_PIXELS];
+    int i,j;
+
+    // grid pixels are exact in double, so the low parts are 0
+    memset(lo,0,sizeof(lo));
+    for(i=0;i<TILE_PIXELS;i++)
+    {
+        x[i] = (key->tx*TILE_PIXELS + i)*image_data->spacing;
+    }
+    for(j=0;j<TILE_PIXELS;j++)
+    {
+        for(i=0;i<TILE_PIXELS;i++)
+        {
+            y[i] = (key->ty*TILE_PIXELS + j)*image_data->spacing;
+        }
+        kernel_span(image_data->kernel,x,lo,y,lo,TILE_PIXELS,image_data->iterations,counts + j*TILE_PIXELS);
+    }
+}
+
+// Copy one quadtree tile into the image, from the cache or computed and stored there
+void cache_tile( void *threadarg, int item )
+{
+    struct image_thread_data *image_data;
+    image_data = (struct image_thread_data *) threadarg;
+
+    struct tile_key key = image_data->tile;
+    int counts[TILE_PIXELS*TILE_PIXELS];
+    int i,j;
+
+    key.tx = image_data->first_tx + item % image_data->cache_across;
+    key.ty = image_data->first_ty + item / image_data->cache_across;
+
+    if (!tilecache_load(image_data->cache, &key, counts))
+    {
+        compute_grid_tile(image_data, &key, counts);
+        tilecache_store(image_data->cache, &key, counts);
+    }
 
-	return iteration_to_color(iter,max);
+    // the image pixels the tile covers
+    long long left = key.tx*TILE_PIXELS - image_data->grid_x;
+    long long top = key.ty*TILE_PIXELS - image_data->grid_y;
+    int start_i = left > 0 ? left : 0;
+    int start_j = top > 0 ? top : 0;
+    int end_i = left + TILE_PIXELS < image_data->width ? left + TILE_PIXELS : image_data->width;
+    int end_j = top + TILE_PIXELS < image_data->height ? top + TILE_PIXELS : image_data->height;
+
+    for(j=start_j;j<end_j;j++)
+    {
+        for(i=start_i;i<end_i;i++)
+        {
+            bitmap_set(image_data->ibm,i,j,counts[(j - top)*TILE_PIXELS + (i - left)]);
+        }
+    }
+}
+
+// Fill row j of the preview from the nearest pixel the progressive passes computed
+void upsample_row( void *threadarg, int j )
+{
+    struct image_thread_data *image_data;
+    image_data = (struct image_thread_data *) threadarg;
+
+    int step = image_data->step;
+    int i;
+    for(i=0;i<image_data->width;i++)
+    {
+        int count = bitmap_get(image_data->ibm, i - i%step, j - j%step);
+        bitmap_set(image_data->preview,i,j,iteration_to_color(count,image_data->iterations));
+    }
+}
+
+// Turn row j of the bitmap from iteration counts into colors
+void colorize_row( void *threadarg, int j )
+{
+    struct image_thread_data *image_data;
+    image_data = (struct image_thread_data *) threadarg;
+
+    int i;
+    for(i=0;i<image_data->width;i++)
+    {
+        bitmap_set(image_data->ibm,i,j,iteration_to_color(bitmap_get(image_data->ibm,i,j),image_data->iterations));
+    }
 }
 
 /*
@@ -0,0 +1,412 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "perturb.h"
+
+/*
+The reference orbit is iterated in fixed point: n 32-bit limbs, least
+significant first, the last one holding the integer part, all of it in
+two's complement.  Only its doubles are kept, the pixels need no more.
+
+A pixel at c = C + dc follows z = Z + d with
+
+	d' = 2*Z*d + d*d + dc
+
+which loses nothing to the size of C.  When z comes closer to 0 than d
+is big, the difference no longer describes z well (a glitch), and when
+the reference escapes there is no Z left to follow.  Either way the
+pixel rebases: d becomes z and it starts over at the beginning of the
+reference orbit, where Z is 0.
+
+Past 1e-270 a pixel's first differences are too small for a double.
+They are kept as a double and a separate binary exponent until they
+grow into range.
+*/
+
+#define GUARD_BITS   64
+#define DOUBLE_RANGE -900	// exponents above this fit in a double
+#define RESCALE_BITS 100
+#define RESCALE      0x1p100
+
+struct reference {
+	int len;		// last index of the orbit, where it escaped or max
+	int max;
+	int bits;
+	double *zx;		// the orbit, zx[0]=zy[0]=0, then C, ...
+	double *zy;
+	double scale_m;		// scale = scale_m * 2^scale_e
+	long scale_e;
+	long rebases;
+};
+
+/* r = a+b */
+static void big_add( uint32_t *r, const uint32_t *a, const uint32_t *b, int n )
+{
+	uint64_t carry = 0;
+	int i;
+	for(i=0;i<n;i++) {
+		carry += (uint64_t)a[i] + b[i];
+		r[i] = carry;
+		carry >>= 32;
+	}
+}
+
+/* r = a-b */
+static void big_sub( uint32_t *r, const uint32_t *a, const uint32_t *b, int n )
+{
+	uint64_t carry = 1;
+	int i;
+	for(i=0;i<n;i++) {
+		carry += (uint64_t)a[i] + (uint32_t)~b[i];
+		r[i] = carry;
+		carry >>= 32;
+	}
+}
+
+static void big_neg( uint32_t *r, const uint32_t *a, int n )
+{
+	uint64_t carry = 1;
+	int i;
+	for(i=0;i<n;i++) {
+		carry += (uint32_t)~a[i];
+		r[i] = carry;
+		carry >>= 32;
+	}
+}
+
+static int big_is_neg( const uint32_t *a, int n )
+{
+	return a[n-1] >> 31;
+}
+
+/* r = a*b, truncated to n limbs.  scratch holds 4n limbs. */
+static void big_mul( uint32_t *r, const uint32_t *a, const uint32_t *b, int n, uint32_t *scratch )
+{
+	uint32_t *pa = scratch, *pb = scratch+n, *p = scratch+2*n;
+	int neg = big_is_neg(a,n) ^ big_is_neg(b,n);
+	int i, j;
+
+	if(big_is_neg(a,n)) big_neg(pa,a,n); else memcpy(pa,a,n*4);
+	if(big_is_neg(b,n)) big_neg(pb,b,n); else memcpy(pb,b,n*4);
+	memset(p,0,2*n*4);
+
+	for(i=0;i<n;i++) {
+		uint64_t carry = 0;
+		if(!pa[i]) continue;
+		for(j=0;j<n;j++) {
+			carry += (uint64_t)pa[i]*pb[j] + p[i+j];
+			p[i+j] = carry;
+			carry >>= 32;
+		}
+		p[i+n] = carry;
+	}
+
+	// both had n-1 fraction limbs, the product has twice that
+	if(neg) big_neg(r,p+n-1,n); else memcpy(r,p+n-1,n*4);
+}
+
+/* a /= 10 for a >= 0 */
+static void big_div10( uint32_t *a, int n )
+{
+	uint64_t rem = 0;
+	int i;
+	for(i=n-1;i>=0;i--) {
+		uint64_t cur = (rem << 32) | a[i];
+		a[i] = cur / 10;
+		rem = cur % 10;
+	}
+}
+
+static double big_to_double( const uint32_t *a, int n, uint32_t *scratch )
+{
+	double d = 0;
+	int neg = big_is_neg(a,n);
+	int i, top;
+
+	if(neg) {
+		big_neg(scratch,a,n);
+		a = scratch;
+	}
+	for(top=n-1;top>0 && !a[top];top--);
+	for(i=top;i>=0 && i>top-3;i--) {
+		d += ldexp(a[i],32*(i-(n-1)));
+	}
+	return neg ? -d : d;
+}
+
+/* Split a decimal number into its digits and the position of the point. */
+static char * decimal_digits( const char *s, int *neg, long *point )
+{
+	char *digits = malloc(strlen(s)+1);
+	int n = 0, dot = 0;
+
+	*point = 0;
+	*neg = 0;
+	while(*s==' ' || *s=='\t') s++;
+	if(*s=='-' || *s=='+') *neg = *s++ == '-';
+
+	for(;;s++) {
+		if(*s>='0' && *s<='9') {
+			digits[n++] = *s;
+			if(!dot) (*point)++;
+		} else if(*s=='.' && !dot) {
+			dot = 1;
+		} else {
+			break;
+		}
+	}
+	digits[n] = 0;
+	if(*s=='e' || *s=='E') *point += atol(s+1);
+
+	return digits;
+}
+
+static void big_parse( uint32_t *r, const char *s, int n )
+{
+	int neg;
+	long point, i;
+	char *digits = decimal_digits(s,&neg,&point);
+	long len = strlen(digits);
+	uint32_t whole = 0;
+
+	// the fraction from its last digit up, dividing by 10 each time
+	memset(r,0,n*4);
+	for(i=len-1;i>=0 && i>=point;i--) {
+		r[n-1] += digits[i]-'0';
+		big_div10(r,n);
+	}
+	for(i=point;i<0;i++) {
+		big_div10(r,n);
+	}
+	// then the integer part, which is small
+	for(i=0;i<point;i++) {
+		whole = whole*10 + (i<len ? digits[i]-'0' : 0);
+	}
+	r[n-1] += whole;
+
+	if(neg) big_neg(r,r,n);
+	free(digits);
+}
+
+/* A positive decimal as m*2^e, 0.5 <= m < 1.  Doubles would underflow. */
+static double parse_scale( const char *s, long *e )
+{
+	int neg, k;
+	long point, i;
+	char *digits = decimal_digits(s,&neg,&point);
+	double m = 0;
+
+	// 17 digits are all a double holds, the rest only move the point
+	int used = 0;
+	for(i=0;digits[i] && used<17;i++) {
+		if(m==0 && digits[i]=='0') continue;
+		m = m*10 + (digits[i]-'0');
+		used++;
+	}
+	double exp10 = point - i;
+	free(digits);
+
+	if(m==0) {
+		*e = 0;
+		return 0;
+	}
+
+	double exp2 = exp10 * M_LN10 / M_LN2;
+	*e = floor(exp2);
+	m = frexp(m * pow(2,exp2-*e),&k);
+	*e += k;
+	return m;
+}
+
+/*
+Iterate the reference orbit at x,y, given as decimal strings, in enough
+bits to resolve pixels of a view of the given scale.
+*/
+
+struct reference * reference_create( const char *x, const char *y, const char *scale, int max )
+{
+	struct reference *r = calloc(1,sizeof *r);
+	if(!r) return 0;
+
+	r->max = max;
+	r->scale_m = parse_scale(scale,&r->scale_e);
+	r->bits = GUARD_BITS + (r->scale_e < 0 ? -r->scale_e : 0);
+
+	int n = r->bits/32 + 2;
+	uint32_t *mem = calloc(11*n,4);
+	r->zx = malloc((max+2)*sizeof(double));
+	r->zy = malloc((max+2)*sizeof(double));
+	if(!mem || !r->zx || !r->zy) {
+		free(mem);
+		reference_delete(r);
+		return 0;
+	}
+
+	uint32_t *cx = mem, *cy = mem+n, *zx = mem+2*n, *zy = mem+3*n;
+	uint32_t *xx = mem+4*n, *yy = mem+5*n, *xy = mem+6*n, *scratch = mem+7*n;
+	big_parse(cx,x,n);
+	big_parse(cy,y,n);
+
+	// Z starts at 0, as z does for every pixel
+	int i;
+	for(i=0;;i++) {
+		r->zx[i] = big_to_double(zx,n,scratch);
+		r->zy[i] = big_to_double(zy,n,scratch);
+		if(i>max || r->zx[i]*r->zx[i] + r->zy[i]*r->zy[i] > 4) break;
+
+		big_mul(xx,zx,zx,n,scratch);
+		big_mul(yy,zy,zy,n,scratch);
+		big_mul(xy,zx,zy,n,scratch);
+
+		big_sub(zx,xx,yy,n);
+		big_add(zx,zx,cx,n);
+		big_add(zy,xy,xy,n);
+		big_add(zy,zy,cy,n);
+	}
+	r->len = i;
+
+	free(mem);
+	return r;
+}
+
+void reference_delete( struct reference *r )
+{
+	free(r->zx);
+	free(r->zy);
+	free(r);
+}
+
+/*
+While d is too small for a double, d = (wx,wy)*2^we and dc = (ux,uy)*2^we.
+d*d is left out, it is less than 2^-800 of 2*Z*d.  Leaves d in a double
+once it fits, or as it was when the pixel escaped or ran out.
+*/
+
+static int iterate_tiny( struct reference *r, double *dx, double *dy, long *de, int *n, long *rebases )
+{
+	double wx = *dx, wy = *dy, ux = *dx, uy = *dy;
+	long we = *de;
+	int iter = 0;
+
+	while(iter<r->max && we<=DOUBLE_RANGE) {
+		double zx = r->zx[*n], zy = r->zy[*n];
+
+		// z is Z, give or take far less than a double sees
+		if(zx*zx + zy*zy > 4) break;
+		if(*n==r->len) {
+			// d is nothing next to z, rebasing just drops it
+			*dx = zx;
+			*dy = zy;
+			*de = 0;
+			*n = 0;
+			(*rebases)++;
+			return iter;
+		}
+
+		double nx = 2*(zx*wx - zy*wy) + ux;
+		double ny = 2*(zx*wy + zy*wx) + uy;
+		wx = nx;
+		wy = ny;
+
+		// keep w in range by moving powers of two into we
+		if(fabs(wx) > RESCALE || fabs(wy) > RESCALE) {
+			wx /= RESCALE;
+			wy /= RESCALE;
+			ux /= RESCALE;
+			uy /= RESCALE;
+			we += RESCALE_BITS;
+		}
+
+		(*n)++;
+		iter++;
+	}
+
+	*dx = ldexp(wx,we);
+	*dy = ldexp(wy,we);
+	*de = 0;
+	return iter;
+}
+
+/*
+Return the number of iterations at the pixel offset ox,oy from
+the center, in units of the scale.
+*/
+
+static int iterations_at_offset( struct reference *r, double ox, double oy, long *rebases )
+{
+	const double *Zx = r->zx, *Zy = r->zy;
+	double dx = ox * r->scale_m, dy = oy * r->scale_m;
+	double cx = ldexp(dx,r->scale_e), cy = ldexp(dy,r->scale_e);
+	long de = r->scale_e;
+	int n = 1;		// z0 = c = Z1 + dc
+	int iter = 0;
+
+	if(de<=DOUBLE_RANGE) {
+		iter = iterate_tiny(r,&dx,&dy,&de,&n,rebases);
+	} else {
+		dx = cx;
+		dy = cy;
+	}
+
+	while(iter<r->max) {
+		double zx = Zx[n] + dx;
+		double zy = Zy[n] + dy;
+		double z2 = zx*zx + zy*zy;
+
+		if(z2 > 4) return iter;
+
+		if(z2 < dx*dx + dy*dy || n==r->len) {
+			dx = zx;
+			dy = zy;
+			n = 0;
+			(*rebases)++;
+		}
+
+		double Zxn = Zx[n], Zyn = Zy[n];
+		double nx = 2*(Zxn*dx - Zyn*dy) + (dx*dx - dy*dy) + cx;
+		double ny = 2*(Zxn*dy + Zyn*dx) + 2*dx*dy + cy;
+		dx = nx;
+		dy = ny;
+
+		n++;
+		iter++;
+	}
+
+	return iter;
+}
+
+/*
+Compute the iterations of n pixels of row j, starting at column i,
+of a width by height image centered on the reference.
+*/
+
+void reference_span( struct reference *r, int i, int j, int n, int width, int height, int *iters )
+{
+	long rebases = 0;
+	double oy = 2.0*j/height - 1;
+	int k;
+
+	for(k=0;k<n;k++) {
+		double ox = 2.0*(i+k)/width - 1;
+		iters[k] = iterations_at_offset(r,ox,oy,&rebases);
+	}
+
+	__atomic_fetch_add(&r->rebases,rebases,__ATOMIC_RELAXED);
+}
+
+int reference_length( struct reference *r )
+{
+	return r->len;
+}
+
+int reference_bits( struct reference *r )
+{
+	return r->bits;
+}
+
+long reference_rebases( struct reference *r )
+{
+	return r->rebases;
+}
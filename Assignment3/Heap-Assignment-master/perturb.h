@@ -0,0 +1,20 @@
+#ifndef PERTURB_H
+#define PERTURB_H
+
+/*
+Deep zoom by perturbation.  One reference orbit, at the center of the
+image, is iterated in as many bits as the zoom needs.  Every pixel then
+iterates only its difference from that orbit, which stays small enough
+for doubles however deep the zoom goes.
+*/
+
+struct reference;
+
+struct reference * reference_create( const char *x, const char *y, const char *scale, int max );
+void               reference_delete( struct reference *r );
+void               reference_span( struct reference *r, int i, int j, int n, int width, int height, int *iters );
+int                reference_length( struct reference *r );
+int                reference_bits( struct reference *r );
+long               reference_rebases( struct reference *r );
+
+#endif
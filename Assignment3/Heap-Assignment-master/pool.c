@@ -0,0 +1,226 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+/*
+Every worker owns the items [lo,hi) of the current job.  The owner
+takes items off the low end one at a time, thieves cut off the high
+half, so each worker keeps running on neighbouring items and a steal
+hands over a whole run of them at once.
+*/
+
+struct worker {
+	struct pool *pool;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int id;
+	int lo;
+	int hi;
+	long steals;
+} __attribute__((aligned(64)));
+
+struct pool {
+	struct worker *workers;		// cache line aligned, inside raw
+	void *raw;
+	int size;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;		// a new job was posted, or quit
+	pthread_cond_t done;		// the last busy worker ran out of items
+	unsigned generation;		// bumped once per job
+	int busy;
+	int quit;
+
+	pool_task task;
+	void *arg;
+};
+
+static int take( struct worker *w )
+{
+	int item = -1;
+
+	pthread_mutex_lock(&w->lock);
+	if(w->lo<w->hi) {
+		item = w->lo;
+		__atomic_store_n(&w->lo,item+1,__ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return item;
+}
+
+/* Steal the upper half of the first worker found with items left. */
+static int steal( struct worker *w )
+{
+	struct pool *p = w->pool;
+	int i;
+
+	for(i=1;i<p->size;i++) {
+		struct worker *v = &p->workers[(w->id+i)%p->size];
+
+		// an unlocked look first, so idle thieves do not queue on the lock
+		if(__atomic_load_n(&v->hi,__ATOMIC_RELAXED) <= __atomic_load_n(&v->lo,__ATOMIC_RELAXED)) continue;
+
+		pthread_mutex_lock(&v->lock);
+		int left = v->hi - v->lo;
+		int hi = v->hi;
+		int mid = hi - (left+1)/2;
+		if(left>0) __atomic_store_n(&v->hi,mid,__ATOMIC_RELAXED);
+		pthread_mutex_unlock(&v->lock);
+		if(left<=0) continue;
+
+		pthread_mutex_lock(&w->lock);
+		__atomic_store_n(&w->lo,mid+1,__ATOMIC_RELAXED);
+		__atomic_store_n(&w->hi,hi,__ATOMIC_RELAXED);
+		w->steals++;
+		pthread_mutex_unlock(&w->lock);
+		return mid;
+	}
+
+	return -1;
+}
+
+static void * worker_main( void *arg )
+{
+	struct worker *w = arg;
+	struct pool *p = w->pool;
+	unsigned seen = 0;
+
+	for(;;) {
+		pthread_mutex_lock(&p->lock);
+		while(p->generation==seen && !p->quit) {
+			pthread_cond_wait(&p->start,&p->lock);
+		}
+		if(p->quit) {
+			pthread_mutex_unlock(&p->lock);
+			return 0;
+		}
+		seen = p->generation;
+		pool_task task = p->task;
+		void *task_arg = p->arg;
+		pthread_mutex_unlock(&p->lock);
+
+		// own items first, then other workers' until nobody has any left
+		int item;
+		while((item=take(w))>=0 || (item=steal(w))>=0) {
+			task(task_arg,item);
+		}
+
+		pthread_mutex_lock(&p->lock);
+		if(--p->busy==0) pthread_cond_signal(&p->done);
+		pthread_mutex_unlock(&p->lock);
+	}
+}
+
+struct pool * pool_create( int workers )
+{
+	struct pool *p;
+	int i;
+
+	if(workers<1) return 0;
+
+	p = calloc(1,sizeof *p);
+	if(!p) return 0;
+
+	// plain malloc, memalign is not something every allocator we run on has
+	p->raw = malloc((workers+1)*sizeof(struct worker));
+	if(!p->raw) {
+		free(p);
+		return 0;
+	}
+	p->workers = (struct worker *)(((unsigned long)p->raw + 63) & ~63UL);
+
+	pthread_mutex_init(&p->lock,0);
+	pthread_cond_init(&p->start,0);
+	pthread_cond_init(&p->done,0);
+
+	for(i=0;i<workers;i++) {
+		struct worker *w = &p->workers[i];
+		w->pool = p;
+		w->id = i;
+		w->lo = w->hi = 0;
+		w->steals = 0;
+		pthread_mutex_init(&w->lock,0);
+		if(pthread_create(&w->thread,0,worker_main,w)) {
+			pthread_mutex_destroy(&w->lock);
+			p->size = i;
+			pool_delete(p);
+			return 0;
+		}
+		p->size = i+1;
+	}
+
+	return p;
+}
+
+void pool_delete( struct pool *p )
+{
+	int i;
+
+	pthread_mutex_lock(&p->lock);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->start);
+	pthread_mutex_unlock(&p->lock);
+
+	for(i=0;i<p->size;i++) {
+		pthread_join(p->workers[i].thread,0);
+		pthread_mutex_destroy(&p->workers[i].lock);
+	}
+
+	pthread_cond_destroy(&p->done);
+	pthread_cond_destroy(&p->start);
+	pthread_mutex_destroy(&p->lock);
+	free(p->raw);
+	free(p);
+}
+
+/*
+Run task on items 0 to items-1 and return once all of them are done.
+Not to be called from a task.
+*/
+
+void pool_run( struct pool *p, pool_task task, void *arg, int items )
+{
+	int i;
+
+	if(items<=0) return;
+
+	pthread_mutex_lock(&p->lock);
+	for(i=0;i<p->size;i++) {
+		struct worker *w = &p->workers[i];
+		pthread_mutex_lock(&w->lock);
+		__atomic_store_n(&w->lo,(int)((long)items*i/p->size),__ATOMIC_RELAXED);
+		__atomic_store_n(&w->hi,(int)((long)items*(i+1)/p->size),__ATOMIC_RELAXED);
+		pthread_mutex_unlock(&w->lock);
+	}
+	p->task = task;
+	p->arg = arg;
+	p->busy = p->size;
+	p->generation++;
+	pthread_cond_broadcast(&p->start);
+
+	while(p->busy>0) {
+		pthread_cond_wait(&p->done,&p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+int pool_size( struct pool *p )
+{
+	return p->size;
+}
+
+long pool_steals( struct pool *p )
+{
+	long steals = 0;
+	int i;
+
+	for(i=0;i<p->size;i++) {
+		pthread_mutex_lock(&p->workers[i].lock);
+		steals += p->workers[i].steals;
+		pthread_mutex_unlock(&p->workers[i].lock);
+	}
+
+	return steals;
+}
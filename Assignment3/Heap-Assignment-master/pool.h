@@ -0,0 +1,22 @@
+#ifndef POOL_H
+#define POOL_H
+
+/*
+A fixed set of worker threads that run jobs of numbered items.
+Each worker starts a job with an equal share of the items and, once
+that runs out, steals half of what another worker has left.  Between
+jobs the workers sleep, so one pool can serve any number of frames.
+*/
+
+struct pool;
+
+/** Called once for every item of a job, from one of the workers. */
+typedef void (*pool_task)( void *arg, int item );
+
+struct pool * pool_create( int workers );
+void          pool_delete( struct pool *p );
+void          pool_run( struct pool *p, pool_task task, void *arg, int items );
+int           pool_size( struct pool *p );
+long          pool_steals( struct pool *p );
+
+#endif
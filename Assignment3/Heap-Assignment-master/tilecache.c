@@ -0,0 +1,275 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tilecache.h"
+
+/*
+A tile file starts with its key, so a stale or renamed file is never
+taken for another tile, followed by the counts row by row.  Files are
+written under a temporary name and renamed into place, so a reader sees
+a whole tile or none.  Every use sets the file's modification time,
+which keeps the least recently used order from one run to the next.
+*/
+
+#define TILE_MAGIC  0x4c49544d	// "MTIL"
+#define TILE_COUNTS (TILE_PIXELS*TILE_PIXELS)
+#define NAME_LEN    96
+
+struct tile_header {
+	int magic;
+	struct tile_key key;
+};
+
+struct entry {
+	char name[NAME_LEN];
+	long long used;		// ns since the epoch
+	long long bytes;
+};
+
+struct tilecache {
+	char *dir;
+	long long limit;
+
+	pthread_mutex_t lock;	// the entries and the stats
+	struct entry *entries;
+	int count;
+	int room;
+	long long bytes;
+
+	long hits;
+	long misses;
+	long evicted;
+};
+
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME,&ts);
+	return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+static void tile_name( const struct tile_key *key, char *name )
+{
+	snprintf(name,NAME_LEN,"L%d_%lld_%lld_m%d_p%d_e%d.tile",
+		key->level,key->tx,key->ty,key->max,key->precision,key->early_outs);
+}
+
+static int same_key( const struct tile_key *a, const struct tile_key *b )
+{
+	return a->level==b->level && a->tx==b->tx && a->ty==b->ty && a->max==b->max
+		&& a->precision==b->precision && a->early_outs==b->early_outs;
+}
+
+static int find( struct tilecache *c, const char *name )
+{
+	int i;
+	for(i=0;i<c->count;i++) {
+		if(!strcmp(c->entries[i].name,name)) return i;
+	}
+	return -1;
+}
+
+/* Note a tile as just used, adding it if it is new.  Lock held. */
+static void touch( struct tilecache *c, const char *name, long long used, long long bytes )
+{
+	int i = find(c,name);
+
+	if(i<0) {
+		if(c->count==c->room) {
+			int room = c->room ? 2*c->room : 64;
+			struct entry *e = realloc(c->entries,room*sizeof(struct entry));
+			if(!e) return;
+			c->entries = e;
+			c->room = room;
+		}
+		i = c->count++;
+		strcpy(c->entries[i].name,name);
+		c->entries[i].bytes = 0;
+	}
+	c->bytes += bytes - c->entries[i].bytes;
+	c->entries[i].bytes = bytes;
+	c->entries[i].used = used;
+}
+
+/* Delete least recently used tiles until the rest fit.  Lock held. */
+static void evict( struct tilecache *c )
+{
+	char path[strlen(c->dir) + NAME_LEN + 2];
+
+	while(c->bytes > c->limit && c->count>0) {
+		int i, oldest = 0;
+		for(i=1;i<c->count;i++) {
+			if(c->entries[i].used < c->entries[oldest].used) oldest = i;
+		}
+		snprintf(path,sizeof(path),"%s/%s",c->dir,c->entries[oldest].name);
+		unlink(path);
+		c->bytes -= c->entries[oldest].bytes;
+		c->entries[oldest] = c->entries[--c->count];
+		c->evicted++;
+	}
+}
+
+static int read_all( int fd, void *buf, size_t n )
+{
+	char *p = buf;
+	while(n>0) {
+		ssize_t got = read(fd,p,n);
+		if(got<=0) return 0;
+		p += got;
+		n -= got;
+	}
+	return 1;
+}
+
+static int write_all( int fd, const void *buf, size_t n )
+{
+	const char *p = buf;
+	while(n>0) {
+		ssize_t put = write(fd,p,n);
+		if(put<=0) return 0;
+		p += put;
+		n -= put;
+	}
+	return 1;
+}
+
+/*
+Open the cache in dir, making the directory if need be, and take stock
+of the tiles already there.  limit is in bytes.  Returns 0 if the
+directory can't be made or read, with errno set.
+*/
+
+struct tilecache * tilecache_open( const char *dir, long long limit )
+{
+	struct tilecache *c;
+	struct dirent *d;
+	DIR *dp;
+
+	if(mkdir(dir,0777)<0 && errno!=EEXIST) return 0;
+	dp = opendir(dir);
+	if(!dp) return 0;
+
+	c = calloc(1,sizeof(*c));
+	if(!c) {
+		closedir(dp);
+		return 0;
+	}
+	c->dir = strdup(dir);
+	c->limit = limit;
+	pthread_mutex_init(&c->lock,0);
+
+	char path[strlen(dir) + NAME_LEN + 2];
+	while((d = readdir(dp))) {
+		size_t len = strlen(d->d_name);
+		struct stat st;
+		if(len<5 || len>=NAME_LEN || strcmp(d->d_name+len-5,".tile")) continue;
+		snprintf(path,sizeof(path),"%s/%s",dir,d->d_name);
+		if(stat(path,&st)<0) continue;
+		touch(c,d->d_name,st.st_mtim.tv_sec*1000000000LL + st.st_mtim.tv_nsec,st.st_size);
+	}
+	closedir(dp);
+
+	// a smaller limit than last time takes effect at once
+	pthread_mutex_lock(&c->lock);
+	evict(c);
+	pthread_mutex_unlock(&c->lock);
+
+	return c;
+}
+
+void tilecache_close( struct tilecache *c )
+{
+	pthread_mutex_destroy(&c->lock);
+	free(c->entries);
+	free(c->dir);
+	free(c);
+}
+
+/*
+Read the counts of a tile into counts, TILE_PIXELS rows of TILE_PIXELS.
+Returns 1 on a hit and 0 on a miss.
+*/
+
+int tilecache_load( struct tilecache *c, const struct tile_key *key, int *counts )
+{
+	char name[NAME_LEN];
+	char path[strlen(c->dir) + NAME_LEN + 2];
+	struct tile_header h;
+	int hit = 0;
+
+	tile_name(key,name);
+	snprintf(path,sizeof(path),"%s/%s",c->dir,name);
+
+	int fd = open(path,O_RDONLY);
+	if(fd>=0) {
+		hit = read_all(fd,&h,sizeof(h)) && h.magic==TILE_MAGIC && same_key(&h.key,key)
+			&& read_all(fd,counts,TILE_COUNTS*sizeof(int));
+		if(hit) futimens(fd,0);
+		close(fd);
+	}
+
+	pthread_mutex_lock(&c->lock);
+	if(hit) {
+		c->hits++;
+		touch(c,name,now_ns(),sizeof(h) + TILE_COUNTS*sizeof(int));
+	} else {
+		c->misses++;
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	return hit;
+}
+
+/*
+Write the counts of a tile, then make room for it.  A tile that can't
+be written is only not cached.
+*/
+
+void tilecache_store( struct tilecache *c, const struct tile_key *key, const int *counts )
+{
+	char name[NAME_LEN];
+	char path[strlen(c->dir) + NAME_LEN + 2];
+	char temp[strlen(c->dir) + NAME_LEN + 10];
+	struct tile_header h;
+
+	memset(&h,0,sizeof(h));
+	h.magic = TILE_MAGIC;
+	h.key = *key;
+
+	tile_name(key,name);
+	snprintf(path,sizeof(path),"%s/%s",c->dir,name);
+	snprintf(temp,sizeof(temp),"%s.XXXXXX",path);
+
+	int fd = mkstemp(temp);
+	if(fd<0) return;
+	int ok = write_all(fd,&h,sizeof(h)) && write_all(fd,counts,TILE_COUNTS*sizeof(int));
+	ok = !close(fd) && ok;
+	if(!ok || rename(temp,path)<0) {
+		unlink(temp);
+		return;
+	}
+
+	pthread_mutex_lock(&c->lock);
+	touch(c,name,now_ns(),sizeof(h) + TILE_COUNTS*sizeof(int));
+	evict(c);
+	pthread_mutex_unlock(&c->lock);
+}
+
+void tilecache_stats( struct tilecache *c, long *hits, long *misses, long *evicted, int *tiles, long long *bytes )
+{
+	pthread_mutex_lock(&c->lock);
+	*hits = c->hits;
+	*misses = c->misses;
+	*evicted = c->evicted;
+	*tiles = c->count;
+	*bytes = c->bytes;
+	pthread_mutex_unlock(&c->lock);
+}
@@ -0,0 +1,33 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+/*
+A directory of computed tiles.  The plane is cut into a quadtree: the
+tiles of level 0 are 4 units across, each level halves them, and every
+tile holds TILE_PIXELS x TILE_PIXELS iteration counts whatever its
+level.  A tile is filed under its level and place and under the max,
+precision and early outs it was computed with, as those decide its
+counts.  Once the files pass the size limit the least recently used go.
+*/
+
+#define TILE_PIXELS 256
+#define TILE_LEVELS 47		// deeper, the grid passes 2^53 pixels and double
+
+struct tile_key {
+	int level;
+	long long tx;		// place on the level's grid, tile 0,0 starts at 0,0
+	long long ty;
+	int max;
+	int precision;
+	int early_outs;
+};
+
+struct tilecache;
+
+struct tilecache * tilecache_open( const char *dir, long long limit );
+void               tilecache_close( struct tilecache *c );
+int                tilecache_load( struct tilecache *c, const struct tile_key *key, int *counts );
+void               tilecache_store( struct tilecache *c, const struct tile_key *key, const int *counts );
+void               tilecache_stats( struct tilecache *c, long *hits, long *misses, long *evicted, int *tiles, long long *bytes );
+
+#endif